@@ -101,6 +101,11 @@ class IncludedModule < Module
   def attach_to(cls)
     @superclass = cls.direct_superclass
     cls.superclass = self
+
+    # Our methods and constants now come before those further up the
+    # hierarchy.
+    @method_table.keys.each { |name| Rubinius::VM.reset_method_cache name }
+    Rubinius::VM.reset_constant_cache
   end
 
   def name
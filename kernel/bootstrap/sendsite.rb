@@ -33,6 +33,14 @@ class SendSite
     raise PrimitiveFailure, "Sendsite#misses primitive failed"
   end
 
+  ##
+  # Returns an Array of [receiver class, hits] pairs, one for each
+  # receiver class cached at this SendSite.
+  def entries
+    Ruby.primitive :sendsite_entries
+    raise PrimitiveFailure, "Sendsite#entries primitive failed"
+  end
+
   ##
   # Sets the sender field on the SendSite.
   # +cm+ must be a CompiledMethod object
@@ -34,6 +34,16 @@ class Rubinius::VM
     raise PrimitiveFailure, "primitive failed"
   end
 
+  def self.reset_constant_cache
+    Ruby.primitive :vm_reset_constant_cache
+    raise PrimitiveFailure, "primitive failed"
+  end
+
+  def self.method_cache_stats
+    Ruby.primitive :vm_method_cache_stats
+    raise PrimitiveFailure, "primitive failed"
+  end
+
   def self.coerce_to_array(object)
     array = object.respond_to?(:to_a) ? object.to_a : [object]
     raise TypeError.new("`to_a' did not return Array") unless array.is_a?(Array)
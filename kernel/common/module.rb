@@ -551,6 +551,7 @@ class Module
       value.set_name_if_necessary(name, self)
     end
     constants_table[normalize_const_name(name)] = value
+    Rubinius::VM.reset_constant_cache
 
     return value
   end
@@ -664,6 +665,7 @@ class Module
     raise ArgumentError, "empty file name" if path.empty?
     trigger = Autoload.new(name, self, path)
     constants_table[name] = trigger
+    Rubinius::VM.reset_constant_cache
     return nil
   end
 
@@ -679,7 +681,9 @@ class Module
   def remove_const(name)
     sym = name.to_sym
     const_missing(name) unless constants_table.has_key?(sym)
-    constants_table.delete(sym)
+    value = constants_table.delete(sym)
+    Rubinius::VM.reset_constant_cache
+    value
   end
 
   private :remove_const
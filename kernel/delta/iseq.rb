@@ -175,7 +175,14 @@ class InstructionSet
     {:opcode => :push_scope, :args => [], :stack => [0, 1]},
     {:opcode => :add_scope,  :args => [], :stack => [1, 0]},
     {:opcode => :rotate, :args => [:int], :stack => [0,0]},
-    {:opcode => :pop_exception, :args => [], :stack => [1, 0]}
+    {:opcode => :pop_exception, :args => [], :stack => [1, 0]},
+
+    # sends whose target has been inlined by the VM, never emitted by
+    # the compiler.
+    {:opcode => :inline_send_method, :args => [:literal], :stack => [1,1],
+      :flow => :send, :vm_flags => [:check_interrupts]},
+    {:opcode => :inline_send_stack, :args => [:literal, :int],
+      :stack => [-121,1], :flow => :send, :vm_flags => [:check_interrupts]}
   ]
 
 
@@ -0,0 +1,90 @@
+# Counts the sequences of instructions (n-grams) in compiled .rbc files,
+# to pick the superinstructions listed in vm/superinstructions.rb.
+#
+#   bin/rbx lib/bin/opcode_ngrams.rb [-n 2,3] [-t 25] file.rbc ...
+#
+# -n gives the lengths of sequence to count (2 and 3 by default), and -t
+# how many of the most common sequences to print (25 by default). A
+# sequence doesn't run across the target of a branch, or past a branch,
+# return or raise, as the interpreter can't run such a sequence as one
+# instruction.
+
+def each_compiled_method(cm, &block)
+  yield cm
+
+  cm.literals.to_a.each do |lit|
+    each_compiled_method(lit, &block) if lit.kind_of? CompiledMethod
+  end
+end
+
+# Split +cm+'s instructions into runs that a superinstruction could cover.
+def instruction_runs(cm)
+  insns = cm.iseq.decode(false)
+
+  targets = {}
+  insns.each do |insn|
+    targets[insn[1]] = true if insn.first.flow == :goto
+  end
+
+  runs = [[]]
+  ip = 0
+  insns.each do |insn|
+    op = insn.first
+
+    runs << [] if targets[ip] and !runs.last.empty?
+    runs.last << op.opcode
+    runs << [] unless [:sequential, :send].include? op.flow
+
+    ip += 1 + op.arg_count
+  end
+
+  runs
+end
+
+lengths = [2, 3]
+top = 25
+files = []
+
+while arg = ARGV.shift
+  case arg
+  when "-n" then
+    lengths = ARGV.shift.split(",").map { |n| Integer(n) }
+  when "-t" then
+    top = Integer(ARGV.shift)
+  else
+    files << arg
+  end
+end
+
+if files.empty?
+  puts "Usage: opcode_ngrams.rb [-n 2,3] [-t 25] file.rbc ..."
+  exit 1
+end
+
+counts = Hash.new(0)
+total = 0
+
+files.each do |file|
+  File.open(file) do |io|
+    cf = Rubinius::CompiledFile.load(io)
+
+    each_compiled_method(cf.body) do |cm|
+      instruction_runs(cm).each do |run|
+        total += run.size
+
+        lengths.each do |n|
+          0.upto(run.size - n) do |i|
+            counts[run[i, n]] += 1
+          end
+        end
+      end
+    end
+  end
+end
+
+puts "# #{total} instructions in #{files.size} files"
+
+sorted = counts.sort_by { |seq, count| [-count, seq.size] }
+sorted.first(top).each do |seq, count|
+  puts "  #{seq.inspect}, # #{count}"
+end
@@ -12,6 +12,7 @@
 #include "profiler.hpp"
 #include "message.hpp"
 
+#include "builtin/array.hpp"
 #include "builtin/class.hpp"
 #include "builtin/compiledmethod.hpp"
 #include "builtin/contexts.hpp"
@@ -35,9 +36,57 @@ namespace rubinius {
     return env;
   }
 
+  /*
+   * Puts the +count+ values at +args+ where the first instructions of the
+   * block would put them, and starts +ctx+ after those instructions, so
+   * the values don't have to be yielded as a Tuple. Returns false, doing
+   * nothing, if the block needs the Tuple. See VMMethod::find_block_args.
+   */
+  bool BlockEnvironment::call_directly(BlockContext* ctx, Object** args, size_t count) {
+    VMMethod* vmm = ctx->vmm;
+    if(vmm->block_args == VMMethod::cBlockArgsUnknown) vmm->find_block_args();
+
+    switch(vmm->block_args) {
+    case VMMethod::cBlockArgsNone:
+      break;
+    case VMMethod::cBlockArgsSingle:
+      if(count != 1) return false;
+      ctx->push(args[0]);
+      break;
+    case VMMethod::cBlockArgsMulti:
+      // cast_for_multi_block_arg yields the elements of a lone Array.
+      if(count == 0) return false;
+      if(count == 1 && kind_of<Array>(args[0])) return false;
+
+      for(size_t i = 0; i < vmm->block_arg_locals.size(); i++) {
+        VMMethod::BlockArgLocal& local = vmm->block_arg_locals[i];
+        Object* val = i < count ? args[i] : Qnil;
+
+        if(local.home) {
+          ctx->home()->set_local(local.index, val);
+        } else {
+          ctx->set_local(local.index, val);
+        }
+      }
+      break;
+    default:
+      return false;
+    }
+
+    ctx->ip = vmm->block_args_end;
+    return true;
+  }
+
   void BlockEnvironment::call(STATE, Task* task, size_t args) {
-    Object* val;
-    if(args > 0) {
+    MethodContext* sender = task->active();
+    BlockContext* ctx = create_context(state, sender);
+
+    Object** stack_args = args > 0 ? sender->stack_back_position(args - 1) : NULL;
+
+    Object* val = NULL;
+    if(call_directly(ctx, stack_args, args)) {
+      sender->clear_stack(args);
+    } else if(args > 0) {
       Tuple* tup = Tuple::create(state, args);
       for(int i = args - 1; i >= 0; i--) {
         tup->put(state, i, task->pop());
@@ -48,7 +97,7 @@ namespace rubinius {
       val = Qnil;
     }
     task->pop(); // Remove this from the stack.
-    BlockContext* ctx = create_context(state, task->active());
+
     if(task->profiler) {
       profiler::Method* prof_meth = task->profiler->enter_method(
           as<Symbol>(home_->name()), home_->module()->name(), profiler::kBlock);
@@ -58,12 +107,16 @@ namespace rubinius {
       }
     }
     task->make_active(ctx);
-    task->push(val);
+    if(val) task->push(val);
   }
 
   void BlockEnvironment::call(STATE, Task* task, Message& msg) {
-    Object* val;
-    if(msg.args() > 0) {
+    BlockContext* ctx = create_context(state, task->active());
+
+    Object* val = NULL;
+    if(call_directly(ctx, msg.arguments(), msg.args())) {
+      // Nothing to push.
+    } else if(msg.args() > 0) {
       Tuple* tup = Tuple::create(state, msg.args());
       for(int i = msg.args() - 1; i >= 0; i--) {
         tup->put(state, i, msg.get_argument(i));
@@ -73,7 +126,7 @@ namespace rubinius {
     } else {
       val = Qnil;
     }
-    BlockContext* ctx = create_context(state, task->active());
+
     if(task->profiler) {
       profiler::Method* prof_meth = task->profiler->enter_method(
           as<Symbol>(home_->name()), home_->module()->name(), profiler::kBlock);
@@ -87,7 +140,7 @@ namespace rubinius {
     task->active()->clear_stack(msg.stack);
 
     task->make_active(ctx);
-    task->push(val);
+    if(val) task->push(val);
   }
 
   // TODO - Untested!!!!!!!!!!
@@ -45,6 +45,7 @@ namespace rubinius {
     static BlockEnvironment* under_context(STATE, CompiledMethod* cm,
         MethodContext* parent, MethodContext* active, size_t index);
 
+    bool call_directly(BlockContext* ctx, Object** args, size_t count);
     void call(STATE, Task* task, size_t args);
     void call(STATE, Task* task, Message& msg);
     BlockContext* create_context(STATE, MethodContext* sender);
@@ -17,12 +17,14 @@ namespace rubinius {
   private:
     Fixnum* instance_fields_; // slot
     Fixnum* instance_type_;   // slot
+    Fixnum* pretenure_score_; // slot
 
   public:
     /* accessors */
 
     attr_accessor(instance_fields, Fixnum);
     attr_accessor(instance_type, Fixnum);
+    attr_accessor(pretenure_score, Fixnum);
 
     /* interface */
 
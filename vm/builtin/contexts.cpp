@@ -216,6 +216,29 @@ namespace rubinius {
     return ctx;
   }
 
+  /* Copy +this+, which is on the context stack, into the heap, the same
+   * way the young collector copies a context. The copy is its own home
+   * if +this+ is, but otherwise points where +this+ does; see
+   * Task::promote_active for fixing up the rest.
+   */
+  MethodContext* MethodContext::promote(STATE) {
+    MethodContext* ctx = (MethodContext*)state->om->allocate_object(num_fields());
+
+    ctx->initialize_copy(this, 0);
+    ctx->copy_body(this);
+    ctx->initialize_as_reference(state);
+    ctx->post_copy(this);
+
+    if(home() == this) ctx->home(state, ctx);
+
+    // The body was copied without the write barrier.
+    if(ctx->mature_object_p()) {
+      state->om->remember_object(ctx);
+    }
+
+    return ctx;
+  }
+
   /* Retrieve the BlockEnvironment from +this+ BlockContext. We reuse the
    * block field from MethodContext and use a type-safe cast. */
   BlockEnvironment* BlockContext::env() {
@@ -63,6 +63,7 @@ namespace rubinius {
     static void init(STATE);
     static MethodContext* create(STATE, size_t stack_size);
     static MethodContext* create(STATE, Object* recv, CompiledMethod* meth);
+    MethodContext* promote(STATE);
     static void initialize_cache(STATE);
     static void reset_cache(STATE);
 
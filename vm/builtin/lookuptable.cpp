@@ -1,6 +1,7 @@
 #include "vm.hpp"
 #include "vm/object_utils.hpp"
 #include "objectmemory.hpp"
+#include "global_cache.hpp"
 
 #include "builtin/lookuptable.hpp"
 #include "builtin/array.hpp"
@@ -130,6 +131,11 @@ namespace rubinius {
     num_entries = entries_->to_native();
     num_bins = bins_->to_native();
 
+    // Any cached lookup of the name may be out of date now.
+    if(obj_type == MethodTableType) {
+      state->global_cache->invalidate((Symbol*)key);
+    }
+
     if(max_density_p(num_entries, num_bins)) {
       redistribute(state, num_bins <<= 1);
     }
@@ -236,6 +242,10 @@ namespace rubinius {
 
     key_to_sym(key);
 
+    if(obj_type == MethodTableType) {
+      state->global_cache->invalidate((Symbol*)key);
+    }
+
     size_t num_entries = entries_->to_native();
     size_t num_bins = bins_->to_native();
 
@@ -1,6 +1,7 @@
 #include "vm.hpp"
 #include "vm/object_utils.hpp"
 #include "objectmemory.hpp"
+#include "global_cache.hpp"
 
 #include "builtin/class.hpp"
 #include "builtin/module.hpp"
@@ -49,6 +50,12 @@ namespace rubinius {
     under->set_const(state, name, this);
   }
 
+  native_int Module::assign_id(STATE) {
+    native_int id = ++state->om->last_class_id;
+    class_id(state, Fixnum::from(id));
+    return id;
+  }
+
   void Module::set_name(STATE, Module* under, Symbol* name) {
     if(under == G(object)) {
       this->name(state, name);
@@ -63,10 +70,12 @@ namespace rubinius {
 
   void Module::set_const(STATE, Object* sym, Object* val) {
     constants_->store(state, sym, val);
+    state->global_cache->invalidate_constants();
   }
 
   void Module::set_const(STATE, const char* name, Object* val) {
     constants_->store(state, state->symbol(name), val);
+    state->global_cache->invalidate_constants();
   }
 
   Object* Module::get_const(STATE, Symbol* sym) {
@@ -10,7 +10,7 @@ namespace rubinius {
 
   class Module : public Object {
   public:
-    const static size_t fields = 4;
+    const static size_t fields = 5;
     const static object_type type = ModuleType;
 
   private:
@@ -18,6 +18,7 @@ namespace rubinius {
     Symbol* name_;               // slot
     LookupTable* constants_;    // slot
     Module* superclass_;        // slot
+    Fixnum* class_id_;          // slot
 
   public:
     /* accessors */
@@ -26,6 +27,7 @@ namespace rubinius {
     attr_accessor(name, Symbol);
     attr_accessor(constants, LookupTable);
     attr_accessor(superclass, Module);
+    attr_accessor(class_id, Fixnum);
 
     /* interface */
     static Module* create(STATE);
@@ -44,6 +46,15 @@ namespace rubinius {
 
     void set_name(STATE, Module* under, Symbol* name);
 
+    /* The number the method caches key on. Unlike the address of the
+     * Module, it stays the same when the GC moves it. */
+    native_int id(STATE) {
+      if(!class_id_->nil_p()) return class_id_->to_native();
+      return assign_id(state);
+    }
+
+    native_int assign_id(STATE);
+
     class Info : public TypeInfo {
     public:
       BASIC_TYPEINFO(TypeInfo)
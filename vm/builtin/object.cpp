@@ -17,6 +17,7 @@
 #include "builtin/float.hpp"
 #include "objectmemory.hpp"
 #include "message.hpp"
+#include "shape.hpp"
 
 #include "vm/object_utils.hpp"
 
@@ -92,7 +93,7 @@ namespace rubinius {
     // then remember other. The up side to just remembering it like
     // this is that other is rarely mature, and the remember_set is
     // flushed on each collection anyway.
-    if(other->zone == MatureObjectZone) {
+    if(other->mature_object_p()) {
       state->om->remember_object(other);
     }
 
@@ -104,6 +105,8 @@ namespace rubinius {
       // and call, the wrong one will be called.
       if(LookupTable* lt = try_as<LookupTable>(ivars_)) {
         other->ivars_ = lt->dup(state);
+      } else if(Tuple* tup = try_as<Tuple>(ivars_)) {
+        other->ivars_ = tup->dup(state);
       } else {
         // Use as<> so that we throw a TypeError if there is something else
         // here.
@@ -158,7 +161,11 @@ namespace rubinius {
       }
     }
 
-    if(CompactLookupTable* tbl = try_as<CompactLookupTable>(ivars_)) {
+    if(Tuple* tup = try_as<Tuple>(ivars_)) {
+      Shape* shape = state->shapes->find(as<Fixnum>(tup->field[0])->to_native());
+      size_t field = shape->field_of(sym);
+      if(field) return tup->field[field];
+    } else if(CompactLookupTable* tbl = try_as<CompactLookupTable>(ivars_)) {
       return tbl->fetch(state, sym);
     } else if(LookupTable* tbl = try_as<LookupTable>(ivars_)) {
       return tbl->fetch(state, sym);
@@ -172,6 +179,9 @@ namespace rubinius {
    * instance variables a CompactTable is used to save memory.  See
    * Object::get_ivar for how to fetch an item out of get_ivars depending upon
    * storage type.
+   *
+   * Ivars kept by Shape (see shape.hpp) are returned as a copy in one of
+   * those, so storing into the result doesn't change the object.
    */
   Object* Object::get_ivars(STATE) {
     if(!reference_p()) {
@@ -181,6 +191,30 @@ namespace rubinius {
       return Qnil;
     }
 
+    if(Tuple* tup = try_as<Tuple>(ivars_)) {
+      Shape* shape = state->shapes->find(as<Fixnum>(tup->field[0])->to_native());
+
+      Object* tbl;
+      if(shape->size() * 2 <= COMPACTLOOKUPTABLE_SIZE) {
+        tbl = CompactLookupTable::create(state);
+      } else {
+        tbl = LookupTable::create(state);
+      }
+
+      for(Shape::Fields::iterator i = shape->fields.begin(); i != shape->fields.end(); i++) {
+        Symbol* name = Symbol::from_index(state, i->first);
+        Object* val = tup->field[i->second];
+
+        if(CompactLookupTable* clt = try_as<CompactLookupTable>(tbl)) {
+          clt->store(state, name, val);
+        } else {
+          as<LookupTable>(tbl)->store(state, name, val);
+        }
+      }
+
+      return tbl;
+    }
+
     return ivars_;
   }
 
@@ -379,12 +413,38 @@ namespace rubinius {
       }
     }
 
-    /* Lazy creation of a lookuptable to store instance variables. */
+    /* Lazy creation of the Tuple to store instance variables in. */
     if(ivars_->nil_p()) {
-      CompactLookupTable* tbl = CompactLookupTable::create(state);
-      ivars(state, tbl);
-      tbl->store(state, sym, val);
-      return val;
+      Tuple* tup = Tuple::create(state, ShapeTable::cInitialIvars + 1);
+      tup->put(state, 0, Fixnum::from(state->shapes->root()->id));
+      ivars(state, tup);
+    }
+
+    if(Tuple* tup = try_as<Tuple>(ivars_)) {
+      Shape* shape = state->shapes->find(as<Fixnum>(tup->field[0])->to_native());
+      size_t field = shape->field_of(sym);
+      if(field) {
+        tup->put(state, field, val);
+        return val;
+      }
+
+      if(Shape* next = state->shapes->add(shape, sym)) {
+        field = next->size();
+
+        if(field >= tup->num_fields()) {
+          Tuple* bigger = Tuple::create(state, field * 2);
+          bigger->copy_range(state, tup, 0, tup->num_fields() - 1, 0);
+          ivars(state, bigger);
+          tup = bigger;
+        }
+
+        tup->put(state, 0, Fixnum::from(next->id));
+        tup->put(state, field, val);
+        return val;
+      }
+
+      /* Too many ivars, or Shapes, for another Shape. */
+      ivars(state, get_ivars(state));
     }
 
     if(CompactLookupTable* tbl = try_as<CompactLookupTable>(ivars_)) {
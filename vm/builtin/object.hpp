@@ -22,7 +22,7 @@ namespace rubinius {
 #define attr_writer(name, type) \
   void name(STATE, type* obj) { \
     name ## _ = obj; \
-    if(zone == MatureObjectZone) this->write_barrier(state, obj); \
+    if(mature_object_p()) this->write_barrier(state, obj); \
   }
 
 /**
@@ -1,29 +1,84 @@
 #include "builtin/sendsite.hpp"
+#include "builtin/array.hpp"
 #include "builtin/class.hpp"
 #include "builtin/lookuptable.hpp"
 #include "builtin/selector.hpp"
 #include "builtin/symbol.hpp"
+#include "builtin/tuple.hpp"
 
 #include "message.hpp"
 #include "global_cache.hpp"
 #include "objectmemory.hpp"
 
 namespace rubinius {
+  /* Whether the methods cached in +ss+ are still the ones a lookup of
+   * its name would find. */
+  static inline bool fresh_p(STATE, SendSite* ss) {
+    return ss->name_serial == state->global_cache->serial(ss->name());
+  }
+
   namespace performer {
+    /*
+     * Look up the method for +msg+ through the global cache, falling
+     * back to method_missing. Raises if even that can't be found.
+     */
+    static void global_resolve(STATE, Message& msg) {
+      Symbol* original_name = msg.name;
+
+      if(!GlobalCacheResolver::resolve_missing(state, msg)) {
+        std::stringstream ss;
+        ss << "could not find method \"" << original_name->c_str(state);
+        ss << "\"";
+        Assertion::raise(ss.str().c_str());
+      }
+    }
+
+    /*
+     * A receiver class the site hasn't seen before. Cache it alongside
+     * the others, unless the site already has all it can hold, in which
+     * case it becomes megamorphic.
+     */
+    static ExecuteStatus cache_miss(STATE, Task* task, Message& msg) {
+      Symbol* original_name = msg.name;
+      SendSite* ss = msg.send_site;
+
+      // Methods of this name have changed, so start over.
+      if(unlikely(!fresh_p(state, ss))) {
+        return basic_performer(state, task, msg);
+      }
+
+      global_resolve(state, msg);
+
+      if(ss->entry_count < SendSite::cMaxEntries) {
+        ss->add_entry(state, msg);
+        ss->performer = poly_performer;
+      } else {
+        ss->performer = mega_performer;
+      }
+
+      if(unlikely(msg.method_missing)) {
+        msg.unshift_argument(state, original_name);
+      }
+
+      return msg.method->execute(state, task, msg);
+    }
+
     /*
      * A simple monomorphic cache resolver. Does not support
      * method missing, so it must not be installed if method missing
      * was used.
      */
     ExecuteStatus mono_performer(STATE, Task* task, Message& msg) {
-      if(likely(msg.lookup_from == msg.send_site->recv_class())) {
+      if(likely(msg.lookup_from == msg.send_site->recv_class() &&
+                fresh_p(state, msg.send_site))) {
         msg.module = msg.send_site->module();
         msg.method = msg.send_site->method();
 
         msg.send_site->hits++;
+        msg.send_site->entries[0].hits++;
       } else {
         msg.send_site->misses++;
-        return basic_performer(state, task, msg);
+        return cache_miss(state, task, msg);
       }
 
       return msg.method->execute(state, task, msg);
@@ -34,14 +89,16 @@ namespace rubinius {
      * a method_missing style dispatch.
      */
     ExecuteStatus mono_mm_performer(STATE, Task* task, Message& msg) {
-      if(likely(msg.lookup_from == msg.send_site->recv_class())) {
+      if(likely(msg.lookup_from == msg.send_site->recv_class() &&
+                fresh_p(state, msg.send_site))) {
         msg.module = msg.send_site->module();
         msg.method = msg.send_site->method();
 
         msg.send_site->hits++;
+        msg.send_site->entries[0].hits++;
       } else {
         msg.send_site->misses++;
-        return basic_performer(state, task, msg);
+        return cache_miss(state, task, msg);
       }
 
       msg.unshift_argument(state, msg.name);
@@ -50,28 +107,67 @@ namespace rubinius {
 
     }
 
-    ExecuteStatus basic_performer(STATE, Task* task, Message& msg) {
-      Symbol* original_name = msg.name;
+    /**
+     * A polymorphic cache, for sites that have seen a few receiver
+     * classes. The entries are searched in the order they were added.
+     */
+    ExecuteStatus poly_performer(STATE, Task* task, Message& msg) {
+      SendSite* ss = msg.send_site;
+      SendSite::Entry* entry = NULL;
+
+      if(likely(fresh_p(state, ss))) entry = ss->find_entry(msg.lookup_from);
+
+      if(unlikely(!entry)) {
+        ss->misses++;
+        return cache_miss(state, task, msg);
+      }
+
+      msg.module = entry->module;
+      msg.method = entry->method;
 
-      if(!GlobalCacheResolver::resolve(state, msg)) {
+      ss->hits++;
+      entry->hits++;
+
+      if(unlikely(entry->method_missing)) {
         msg.method_missing = true;
-        msg.name = G(sym_method_missing);
-        msg.priv = true; // lets us look for method_missing anywhere
+        msg.unshift_argument(state, msg.name);
+      }
 
-        if(!GlobalCacheResolver::resolve(state, msg)) {
-          std::stringstream ss;
-          ss << "could not find method \"" << original_name->c_str(state);
-          ss << "\"";
-          Assertion::raise(ss.str().c_str());
-        }
+      return msg.method->execute(state, task, msg);
+    }
+
+    /**
+     * A site that has seen too many receiver classes to be worth
+     * caching inline. Every send goes to the global cache.
+     */
+    ExecuteStatus mega_performer(STATE, Task* task, Message& msg) {
+      Symbol* original_name = msg.name;
+
+      msg.send_site->misses++;
+      global_resolve(state, msg);
+
+      if(unlikely(msg.method_missing)) {
+        msg.unshift_argument(state, original_name);
       }
 
+      return msg.method->execute(state, task, msg);
+    }
+
+    ExecuteStatus basic_performer(STATE, Task* task, Message& msg) {
+      Symbol* original_name = msg.name;
+
+      global_resolve(state, msg);
+
       // Populate for mono!
       msg.send_site->module(state, msg.module);
       msg.send_site->method(state, msg.method);
       msg.send_site->recv_class(state, msg.lookup_from);
       msg.send_site->method_missing = msg.method_missing;
 
+      msg.send_site->entry_count = 0;
+      msg.send_site->add_entry(state, msg);
+      msg.send_site->name_serial = state->global_cache->serial(msg.send_site->name());
+
       if(unlikely(msg.method_missing)) {
         msg.unshift_argument(state, original_name);
         msg.send_site->performer = mono_mm_performer;
@@ -110,6 +206,8 @@ namespace rubinius {
     recv_class(state, (Module*)Qnil);
     method_missing = false;
     hits = misses = 0;
+    entry_count = 0;
+    name_serial = state->global_cache->serial(name());
   }
 
   Object* SendSite::set_sender(STATE, CompiledMethod* cm) {
@@ -125,6 +223,43 @@ namespace rubinius {
     return Integer::from(state, misses);
   }
 
+  /* Returns an Array of [receiver class, hits] for each receiver class
+   * cached at this site. */
+  Array* SendSite::entries_prim(STATE) {
+    Array* ary = Array::create(state, entry_count);
+
+    for(size_t i = 0; i < entry_count; i++) {
+      ary->append(state, Tuple::from(state, 2, entries[i].recv_class,
+                                     Integer::from(state, entries[i].hits)));
+    }
+
+    return ary;
+  }
+
+  SendSite::Entry* SendSite::find_entry(Module* recv_class) {
+    for(size_t i = 0; i < entry_count; i++) {
+      if(entries[i].recv_class == recv_class) return &entries[i];
+    }
+
+    return NULL;
+  }
+
+  /* Cache what +msg+ resolved to for its receiver class. The caller
+   * checks there is room. */
+  void SendSite::add_entry(STATE, Message& msg) {
+    Entry& entry = entries[entry_count++];
+
+    entry.recv_class = msg.lookup_from;
+    entry.module = msg.module;
+    entry.method = msg.method;
+    entry.method_missing = msg.method_missing;
+    entry.hits = 0;
+
+    write_barrier(state, entry.recv_class);
+    write_barrier(state, entry.module);
+    write_barrier(state, entry.method);
+  }
+
   /* Use the information within +this+ to populate +msg+. Returns
    * true if +msg+ was populated. */
 
@@ -151,11 +286,13 @@ namespace rubinius {
    * and in method tables. Returns true if lookup was successful
    * and +msg+ is now filled in. */
 
-  bool HierarchyResolver::resolve(STATE, Message& msg) {
+  bool HierarchyResolver::resolve(STATE, Message& msg, bool* not_found) {
     Module* module = msg.lookup_from;
     Object* entry;
     MethodVisibility* vis;
 
+    if(not_found) *not_found = false;
+
     do {
       entry = module->method_table()->fetch(state, msg.name);
 
@@ -164,7 +301,10 @@ namespace rubinius {
 
       /* A 'false' method means to terminate method lookup.
        * (eg. undef_method) */
-      if(entry == Qfalse) return false;
+      if(entry == Qfalse) {
+        if(not_found) *not_found = true;
+        return false;
+      }
 
       vis = try_as<MethodVisibility>(entry);
 
@@ -210,7 +350,10 @@ keep_looking:
       module = module->superclass();
 
       /* No more places to look, we couldn't find it. */
-      if(module->nil_p()) return false;
+      if(module->nil_p()) {
+        if(not_found) *not_found = true;
+        return false;
+      }
     } while(1);
 
     return true;
@@ -221,10 +364,11 @@ keep_looking:
 
     entry = state->global_cache->lookup(msg.lookup_from, msg.name);
     if(entry) {
+      if(entry->method_missing) return false;
+
       if(msg.priv || entry->is_public) {
         msg.method = entry->method;
         msg.module = entry->module;
-        msg.method_missing = entry->method_missing;
 
         return true;
       }
@@ -232,15 +376,63 @@ keep_looking:
 
     if(HierarchyResolver::resolve(state, msg)) {
       state->global_cache->retain(state, msg.lookup_from, msg.name,
-          msg.module, msg.method, msg.method_missing);
+          msg.module, msg.method, false);
       return true;
     }
 
     return false;
   }
 
+  bool GlobalCacheResolver::resolve_missing(STATE, Message& msg) {
+    struct GlobalCache::cache_entry* entry;
+    Symbol* original_name = msg.name;
+    bool not_found;
+
+    entry = state->global_cache->lookup(msg.lookup_from, msg.name);
+    if(entry) {
+      if(entry->method_missing) {
+        msg.method_missing = true;
+        msg.name = G(sym_method_missing);
+        msg.priv = true;
+        msg.method = entry->method;
+        msg.module = entry->module;
+
+        return true;
+      }
+
+      if(msg.priv || entry->is_public) {
+        msg.method = entry->method;
+        msg.module = entry->module;
+
+        return true;
+      }
+    }
+
+    if(HierarchyResolver::resolve(state, msg, &not_found)) {
+      state->global_cache->retain(state, msg.lookup_from, msg.name,
+          msg.module, msg.method, false);
+      return true;
+    }
+
+    msg.method_missing = true;
+    msg.name = G(sym_method_missing);
+    msg.priv = true; // lets us look for method_missing anywhere
+
+    if(!resolve(state, msg)) return false;
+
+    // Whether a method that isn't visible to this call is, depends on
+    // the caller, so only a method nobody has is worth remembering.
+    if(not_found) {
+      state->global_cache->retain(state, msg.lookup_from, original_name,
+          msg.module, msg.method, true);
+    }
+
+    return true;
+  }
+
   bool MonomorphicInlineCacheResolver::resolve(STATE, Message& msg) {
-    if(msg.lookup_from == msg.send_site->recv_class()) {
+    if(msg.lookup_from == msg.send_site->recv_class() &&
+       fresh_p(state, msg.send_site)) {
       msg.module = msg.send_site->module();
       msg.method = msg.send_site->method();
       msg.method_missing = msg.send_site->method_missing;
@@ -250,11 +442,12 @@ keep_looking:
     }
 
     msg.send_site->misses++;
-    if(GlobalCacheResolver::resolve(state, msg)) {
+    if(GlobalCacheResolver::resolve_missing(state, msg)) {
       msg.send_site->module(state, msg.module);
       msg.send_site->method(state, msg.method);
       msg.send_site->recv_class(state, msg.lookup_from);
       msg.send_site->method_missing = msg.method_missing;
+      msg.send_site->name_serial = state->global_cache->serial(msg.send_site->name());
 
       return true;
     }
@@ -262,6 +455,33 @@ keep_looking:
     return false;
   }
 
+  void SendSite::Info::mark(Object* obj, ObjectMark& mark) {
+    Object* tmp;
+
+    auto_mark(obj, mark);
+
+    SendSite* ss = as<SendSite>(obj);
+
+    for(size_t i = 0; i < ss->entry_count; i++) {
+      Entry& entry = ss->entries[i];
+
+      if((tmp = mark.call(entry.recv_class))) {
+        entry.recv_class = (Module*)tmp;
+        mark.just_set(obj, tmp);
+      }
+
+      if((tmp = mark.call(entry.module))) {
+        entry.module = (Module*)tmp;
+        mark.just_set(obj, tmp);
+      }
+
+      if((tmp = mark.call(entry.method))) {
+        entry.method = (Executable*)tmp;
+        mark.just_set(obj, tmp);
+      }
+    }
+  }
+
   void SendSite::Info::show(STATE, Object* self, int level) {
     SendSite* ss = as<SendSite>(self);
 
@@ -274,6 +494,11 @@ keep_looking:
     indent_attribute(level, "module"); class_info(state, ss->module(), true);
     indent_attribute(level, "method"); class_info(state, ss->method(), true);
     indent_attribute(level, "recv_class"); class_info(state, ss->recv_class(), true);
+    for(size_t i = 0; i < ss->entry_count; i++) {
+      indent_attribute(level, "entry");
+      class_info(state, ss->entries[i].recv_class);
+      std::cout << " hits: " << ss->entries[i].hits << std::endl;
+    }
     close_body(level);
   }
 };
@@ -5,6 +5,7 @@
 #include "type_info.hpp"
 
 namespace rubinius {
+  class Array;
   class CompiledMethod;
   class Selector;
   class Message;
@@ -17,8 +18,21 @@ namespace rubinius {
     static const size_t fields = 10;
     static const object_type type = SendSiteType;
 
+    // The most receiver classes a site caches before it is considered
+    // megamorphic and just uses the global cache.
+    static const size_t cMaxEntries = 4;
+
     typedef ExecuteStatus (*Performer)(STATE, Task* task, Message& msg);
 
+    /* A receiver class seen at this site, and the method it resolved to. */
+    struct Entry {
+      Module* recv_class;
+      Module* module;
+      Executable* method;
+      bool method_missing;
+      size_t hits;
+    };
+
   private:
     Symbol* name_;            // slot
     CompiledMethod* sender_; // slot
@@ -35,6 +49,13 @@ namespace rubinius {
     MethodResolver resolver;
     Performer performer;
 
+    // Not slots, Info::mark() takes care of them.
+    Entry entries[cMaxEntries];
+    size_t entry_count;
+
+    // The GlobalCache serial of name when the entries were filled in.
+    uint32_t name_serial;
+
   public:
     /* accessors */
 
@@ -61,12 +82,19 @@ namespace rubinius {
     // Ruby.primitive :sendsite_misses
     Object* misses_prim(STATE);
 
+    // Ruby.primitive :sendsite_entries
+    Array* entries_prim(STATE);
+
     void initialize(STATE);
     bool locate(STATE, Message& msg);
 
+    Entry* find_entry(Module* recv_class);
+    void   add_entry(STATE, Message& msg);
+
     class Info : public TypeInfo {
     public:
       BASIC_TYPEINFO(TypeInfo)
+      virtual void mark(Object* obj, ObjectMark& mark);
       virtual void show(STATE, Object* self, int level);
     };
   };
@@ -75,6 +103,8 @@ namespace rubinius {
     ExecuteStatus basic_performer(STATE, Task* task, Message& msg);
     ExecuteStatus mono_performer(STATE, Task* task, Message& msg);
     ExecuteStatus mono_mm_performer(STATE, Task* task, Message& msg);
+    ExecuteStatus poly_performer(STATE, Task* task, Message& msg);
+    ExecuteStatus mega_performer(STATE, Task* task, Message& msg);
   }
 
   /**
@@ -89,11 +119,15 @@ namespace rubinius {
    *  the method and the Module in which it was found are stored in
    *  the Message.
    *
+   *  If +not_found+ is given, it is set to whether the lookup failed
+   *  because no module has the method, rather than because it isn't
+   *  visible to this call. Only the former is the same for every call.
+   *
    *  @returns  true if method is found, false otherwise.
    */
   class HierarchyResolver {
   public:
-    static bool resolve(STATE, Message& msg);
+    static bool resolve(STATE, Message& msg, bool* not_found = NULL);
   };
 
   /**
@@ -112,11 +146,20 @@ namespace rubinius {
    *            the lookup *started*. The information stored includes
    *            the Module in which the Executable was *found*.
    *
+   *  A cached method_missing entry means the method can't be found,
+   *  so resolve() fails straight away for it.
+   *
+   *  resolve_missing() falls back to method_missing if the method
+   *  can't be found, setting up +msg+ to call it, and caches that
+   *  under the name that was sent. Later sends of the name then
+   *  get method_missing from a single cache lookup.
+   *
    *  @returns  true if the method was found, false otherwise.
    */
   class GlobalCacheResolver {
   public:
     static bool resolve(STATE, Message& msg);
+    static bool resolve_missing(STATE, Message& msg);
   };
 
   /**
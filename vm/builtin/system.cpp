@@ -145,13 +145,28 @@ namespace rubinius {
   }
 
   Object* System::vm_reset_method_cache(STATE, Symbol* name) {
-    // 1. clear the global cache
-    state->global_cache->clear(name);
-    // 2. clear the send site caches
-    Selector::clear_by_name(state, name);
+    // The global cache and the send sites notice the new serial the
+    // next time they are used.
+    state->global_cache->invalidate(name);
     return name;
   }
 
+  Object* System::vm_reset_constant_cache(STATE) {
+    state->global_cache->invalidate_constants();
+    return Qnil;
+  }
+
+  Tuple* System::vm_method_cache_stats(STATE) {
+    GlobalCache* cache = state->global_cache;
+
+    return Tuple::from(state, 5,
+                       Fixnum::from(cache->size),
+                       Fixnum::from(CPU_CACHE_WAYS),
+                       Integer::from(state, cache->hits),
+                       Integer::from(state, cache->misses),
+                       Integer::from(state, cache->evictions));
+  }
+
   Object* System::vm_show_backtrace(STATE, Object* ctx) {
     if(ctx == Qnil) {
       G(current_task)->print_backtrace(NULL);
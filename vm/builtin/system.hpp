@@ -12,6 +12,7 @@ namespace rubinius {
   class Array;
   class Fixnum;
   class String;
+  class Tuple;
 
 
   /**
@@ -110,6 +111,24 @@ namespace rubinius {
     // Ruby.primitive :vm_reset_method_cache
     static Object*  vm_reset_method_cache(STATE, Symbol* name);
 
+    /**
+     *  Clears the constant caches of push_const and find_const.
+     *
+     *  Used when the constants a lookup may find change other than
+     *  by Module::set_const, e.g. a constant is removed or a module
+     *  is included.
+     */
+    // Ruby.primitive :vm_reset_constant_cache
+    static Object*  vm_reset_constant_cache(STATE);
+
+    /**
+     *  Returns a Tuple describing the global method cache:
+     *  the number of entries, the number of ways in a set,
+     *  and the number of hits, misses and evictions so far.
+     */
+    // Ruby.primitive :vm_method_cache_stats
+    static Tuple*   vm_method_cache_stats(STATE);
+
     /**
      *  Writes backtrace to standard output.
      */
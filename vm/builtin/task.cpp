@@ -24,6 +24,8 @@
 
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <vector>
 
 #define INSN_DEBUG
 
@@ -92,6 +94,51 @@ namespace rubinius {
     return context;
   }
 
+  /* Move the active context, and any callers that have not escaped yet,
+   * off the context stack and into the heap, giving the space they used
+   * back. Called when a context is about to be captured by a block or
+   * pushed onto a stack, so that only frames which actually escape pay
+   * for a heap allocation; everything else stays on the context stack and
+   * is recycled on return. Returns the new active context. */
+  MethodContext* Task::promote_active() {
+    ObjectMemory* om = state->om;
+    std::vector<MethodContext*> frames;
+    std::map<MethodContext*, MethodContext*> copies;
+
+    for(MethodContext* ctx = active_; !ctx->nil_p(); ctx = ctx->sender()) {
+      if(ctx->obj_type != MethodContextType &&
+         ctx->obj_type != BlockContextType) break;
+      if(!om->context_on_stack_p(ctx)) break;
+      if(om->context_referenced_p(ctx)) break;
+
+      frames.push_back(ctx);
+      copies[ctx] = ctx->promote(state);
+    }
+
+    if(frames.empty()) return active_;
+
+    for(size_t i = 0; i < frames.size(); i++) {
+      MethodContext* copy = copies[frames[i]];
+
+      std::map<MethodContext*, MethodContext*>::iterator it;
+      if((it = copies.find(copy->sender())) != copies.end()) {
+        copy->sender(state, it->second);
+      }
+
+      if((it = copies.find(copy->home())) != copies.end()) {
+        copy->home(state, it->second);
+      }
+    }
+
+    // Newest first, so each one is on top of the stack when released.
+    for(size_t i = 0; i < frames.size(); i++) {
+      om->release_context(frames[i]);
+    }
+
+    active(state, copies[frames[0]]);
+    return active_;
+  }
+
   // Primitive
   Channel* Task::get_debug_channel(STATE) {
     return debug_channel_;
@@ -131,13 +178,8 @@ namespace rubinius {
 
   ExecuteStatus Task::send_message_slowly(Message& msg) {
     Symbol* original_name = msg.name;
-    if(!GlobalCacheResolver::resolve(state, msg)) {
-      msg.method_missing = true;
-      msg.name = G(sym_method_missing);
-      msg.priv = true; // lets us look for method_missing anywhere
-      if(!GlobalCacheResolver::resolve(state, msg)) {
-        tragic_failure(msg);
-      }
+    if(!GlobalCacheResolver::resolve_missing(state, msg)) {
+      tragic_failure(msg);
     }
 
     if(msg.method_missing) {
@@ -279,7 +321,6 @@ namespace rubinius {
     method->scope(state, active_->cm()->scope());
     method->serial(state, Fixnum::from(0));
     mod->method_table()->store(state, name, method);
-    state->global_cache->clear(mod, name);
 
     if(!probe_->nil_p()) {
       probe_->added_method(this, mod, name, method);
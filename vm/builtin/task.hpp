@@ -94,6 +94,7 @@ namespace rubinius {
     bool passed_arg_p(size_t pos);
 
     void methctx_reference(MethodContext* ctx);
+    MethodContext* promote_active();
     void set_ip(int ip);
     int  current_ip();
 
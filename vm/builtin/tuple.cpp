@@ -20,7 +20,7 @@ namespace rubinius {
     }
 
     this->field[idx] = val;
-    if(val->reference_p()) write_barrier(state, val);
+    if(val->reference_p()) state->om->write_barrier(this, &field[idx], val);
     return val;
   }
 
@@ -12,6 +12,7 @@ class Object # for vm debugging
 end
 
 require "#{File.dirname(__FILE__)}/../../kernel/delta/iseq"
+require "#{File.dirname(__FILE__)}/../superinstructions"
 require 'rubygems'
 require 'parse_tree'
 
@@ -142,16 +143,40 @@ class Instructions
   end
 
   # Using an array of Implementation objects, +methods+, print out
-  # the code for each instruction. This uses an indirect threaded
-  # goto to jump between instructions.
+  # the code for each instruction. This uses a direct threaded goto to
+  # jump between instructions: the VMMethod's threaded form holds the
+  # address of the code for each instruction, with its operands inline.
+  #
+  # Interrupts are only checked after sends, instructions flagged with
+  # :check_interrupts, and branches backwards, so that a loop without a
+  # send can still be interrupted. Branches backwards are also counted,
+  # to tell when a method is hot enough to JIT compile.
   #
   def generate_jump_implementations(methods, io, flow=false)
-    io.puts generate_jump_table()
-    io.puts "goto *insn_locations[stream[ctx->ip++]];"
+    io.puts generate_jump_table(superinstructions(methods))
+    io.puts "if(unlikely(!VMMethod::instructions)) VMMethod::instructions = (instlocation*)insn_locations;"
+    io.puts "if(unlikely(!vmm->threaded)) vmm->make_threaded();"
+    io.puts "instlocation* const threaded = vmm->threaded;"
+    io.puts "DISPATCH;"
 
     methods.each do |impl|
       io.puts "  op_impl_#{impl.name.opcode}: {"
 
+      check = impl.name.check_interrupts? || impl.name.flow == :send
+
+      if impl.return_type == "bool"
+        io.puts "#undef RETURN"
+        if check
+          io.puts "#define RETURN(val) if((val) == cExecuteRestart) { return; } else { CHECK_INTERRUPTS; DISPATCH; }"
+        else
+          io.puts "#define RETURN(val) if((val) == cExecuteRestart) { return; } else { DISPATCH; }"
+        end
+      end
+
+      if impl.name.flow == :goto
+        io.puts "  size_t const insn_ip = ctx->ip - 1;"
+      end
+
       args = impl.args
       case args.size
       when 2
@@ -175,14 +200,160 @@ class Instructions
         io.puts "  return;"
       end
 
-      if impl.name.check_interrupts?
-        io.puts "    if(unlikely(state->interrupts.check)) return;"
+      if check
+        io.puts "  CHECK_INTERRUPTS;"
+      elsif impl.name.flow == :goto
+        io.puts "  if((size_t)#{args[0]} <= insn_ip) { BACKWARD_BRANCH; }"
       end
 
-      io.puts "  goto *insn_locations[stream[ctx->ip++]];"
+      io.puts "  DISPATCH;"
       io.puts "  }"
     end
 
+    generate_superinstruction_implementations(methods, io)
+  end
+
+  # Instructions which are rewritten in place after a method is threaded,
+  # or which leave resume() in a way of their own, and so can't be part
+  # of a superinstruction.
+  #
+  NotInSuperinstructions = [:push_ivar, :set_ivar, :push_const, :find_const,
+                            :inline_send_method, :inline_send_stack]
+
+  # Sends which rewrite their own slot to inline their target (see
+  # VMMethod::inline_send). Only the first slot of a superinstruction is
+  # dispatched through, so they can't come later in one.
+  #
+  FirstInSuperinstructions = [:send_method, :send_stack]
+
+  # Return the sequences in superinstructions.rb as arrays of the
+  # Implementation objects, out of +methods+, of their instructions.
+  #
+  def superinstructions(methods)
+    by_name = {}
+    methods.each { |impl| by_name[impl.name.opcode] = impl }
+
+    Superinstructions.map do |seq|
+      impls = seq.map do |name|
+        impl = by_name[name]
+        unless impl
+          raise ArgumentError, "Unknown instruction #{name} in superinstruction #{seq.inspect}"
+        end
+        impl
+      end
+
+      if impls.size < 2
+        raise ArgumentError, "Superinstruction #{seq.inspect} is too short"
+      end
+
+      impls.each_with_index do |impl, i|
+        if NotInSuperinstructions.include? impl.name.opcode
+          raise ArgumentError, "#{impl.name.opcode} can't be in superinstruction #{seq.inspect}"
+        end
+
+        if i > 0 and FirstInSuperinstructions.include? impl.name.opcode
+          raise ArgumentError, "#{impl.name.opcode} must be first in superinstruction #{seq.inspect}"
+        end
+
+        if i < impls.size - 1 and ![:sequential, :send].include? impl.name.flow
+          raise ArgumentError, "#{impl.name.opcode} must be last in superinstruction #{seq.inspect}"
+        end
+      end
+
+      impls
+    end
+  end
+
+  # Print out the code for each superinstruction, to follow the code
+  # printed by generate_jump_implementations. A superinstruction is the
+  # code of its instructions one after the other, stepping over the
+  # opcode of each instruction after the first so that ctx->ip is always
+  # where it would be if they were run one by one. A send in the middle
+  # that doesn't need to leave resume() carries on with the next
+  # instruction, rather than dispatching to it.
+  #
+  def generate_superinstruction_implementations(methods, io)
+    superinstructions(methods).each_with_index do |impls, i|
+      label = "op_super_#{i}"
+      io.puts "  #{label}: { // #{impls.map { |impl| impl.name.opcode }.join(', ')}"
+
+      impls.each_with_index do |impl, j|
+        last = j == impls.size - 1
+        check = impl.name.check_interrupts? || impl.name.flow == :send
+        needs_label = false
+
+        io.puts "  ctx->ip++;" if j > 0
+
+        if impl.return_type == "bool"
+          after = last ? "DISPATCH" : "goto #{label}_#{j + 1}"
+          needs_label = !last
+          after = "CHECK_INTERRUPTS; #{after}" if check
+          io.puts "#undef RETURN"
+          io.puts "#define RETURN(val) if((val) == cExecuteRestart) { return; } else { #{after}; }"
+        end
+
+        io.puts "  {"
+        io.puts "  size_t const insn_ip = ctx->ip - 1;" if impl.name.flow == :goto
+        impl.args.each { |arg| io.puts "  int #{arg} = next_int;" }
+        io.puts "  #{impl.body}"
+
+        if [:return, :raise].include?(impl.name.flow)
+          io.puts "  return;"
+        end
+
+        if check
+          io.puts "  CHECK_INTERRUPTS;"
+        elsif impl.name.flow == :goto
+          io.puts "  if((size_t)#{impl.args[0]} <= insn_ip) { BACKWARD_BRANCH; }"
+        end
+
+        io.puts "  }"
+        io.puts "  #{label}_#{j + 1}:" if needs_label
+      end
+
+      io.puts "  DISPATCH;"
+      io.puts "  }"
+    end
+  end
+
+  # Generate VMMethod::find_superinstruction, which returns where in
+  # VMMethod::instructions the superinstruction for the sequence that
+  # starts at +ip+ is, or 0 if there is none.
+  #
+  def generate_superinstruction_finder(methods)
+    groups = []
+    superinstructions(methods).each_with_index do |impls, i|
+      first = impls.first.name
+      group = groups.find { |name, supers| name == first }
+      groups << (group = [first, []]) unless group
+      group.last << [impls, InstructionSet::OpCodes.size + i]
+    end
+
+    str =  "size_t rubinius::VMMethod::find_superinstruction(size_t ip) {\n"
+    str << "  switch(opcodes[ip]) {\n"
+
+    groups.each do |first, supers|
+      str << "  case InstructionSequence::insn_#{first.opcode}:\n"
+
+      supers = supers.sort_by { |impls, index| [-impls.size, index] }
+      supers.each do |impls, index|
+        offset = 0
+        tests = []
+        impls.each do |impl|
+          tests << "opcodes[ip + #{offset}] == InstructionSequence::insn_#{impl.name.opcode}" if offset > 0
+          offset += 1 + impl.name.arg_count
+        end
+
+        str << "    if(ip + #{offset} <= total &&\n"
+        str << "       #{tests.join(" &&\n       ")}) return #{index};\n"
+      end
+
+      str << "    break;\n"
+    end
+
+    str << "  }\n\n"
+    str << "  return 0;\n"
+    str << "}\n"
   end
 
   # Print to +fd+ a cxxtest formatted class, which contains the test code
@@ -313,11 +484,16 @@ void #{meth}() {
 CODE
   end
 
-  def generate_jump_table
+  # The superinstructions, +supers+, follow the instructions.
+  #
+  def generate_jump_table(supers=[])
     str = "static const void* insn_locations[] = {\n"
     InstructionSet::OpCodes.each do |ins|
       str << "  &&op_impl_#{ins.opcode.to_s},\n"
     end
+    supers.each_index do |i|
+      str << "  &&op_super_#{i},\n"
+    end
     str << "  NULL\n};\n"
 
     return str
@@ -1,3 +1,6 @@
+#ifndef RBX_CONFIG_HPP
+#define RBX_CONFIG_HPP
+
 #include <iostream>
 #include <sstream>
 #include <map>
@@ -28,3 +31,5 @@ namespace rubinius {
     EntryList* get_section(std::string prefix);
   };
 }
+
+#endif
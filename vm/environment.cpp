@@ -76,6 +76,7 @@ namespace rubinius {
     }
 
     state->user_config->import_stream(stream);
+    state->apply_user_config();
   }
 
   void Environment::run_file(std::string file) {
@@ -22,7 +22,7 @@ namespace rubinius {
   void ObjectMark::set(Object* target, Object** pos, Object* val) {
     *pos = val;
     if(val->reference_p()) {
-      gc->object_memory->write_barrier(target, val);
+      gc->object_memory->write_barrier(target, pos, val);
     }
   }
 
@@ -77,7 +77,7 @@ namespace rubinius {
           tmp = saw_object(tmp);
           if(tmp) {
             tup->field[i] = tmp;
-            object_memory->write_barrier(tup, tmp);
+            object_memory->write_barrier(tup, &tup->field[i], tmp);
           }
         }
       }
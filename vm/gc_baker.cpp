@@ -3,6 +3,7 @@
 
 #include "gc_baker.hpp"
 #include "objectmemory.hpp"
+#include "global_cache.hpp"
 #include "vm/object_utils.hpp"
 
 #include "builtin/tuple.hpp"
@@ -14,6 +15,15 @@ namespace rubinius {
     heap_a(bytes),
     heap_b(bytes),
     total_objects(0),
+    survivor_bytes(0),
+    allocated_bytes(0),
+    copied_bytes(0),
+    promoted_bytes(0),
+    adaptive(false),
+    desired_bytes(bytes),
+    min_bytes(bytes / 4),
+    max_bytes(bytes * 16),
+    target_survival(10),
     promoted_(0)
   {
     current = &heap_a;
@@ -35,7 +45,9 @@ namespace rubinius {
     if(next->contains_p(obj)) return obj;
 
     if(obj->age++ >= lifetime) {
+      object_memory->note_survivor(obj);
       copy = object_memory->promote_object(obj);
+      promoted_bytes += obj->size_in_bytes();
 
       promoted_->push_back(copy);
     } else if(next->enough_space_p(obj->size_in_bytes())) {
@@ -43,6 +55,7 @@ namespace rubinius {
       total_objects++;
     } else {
       copy = object_memory->promote_object(obj);
+      promoted_bytes += obj->size_in_bytes();
       promoted_->push_back(copy);
     }
 
@@ -64,6 +77,40 @@ namespace rubinius {
     }
   }
 
+  /* Scan the fields of a big mature Tuple that are in its dirty cards,
+   * cleaning the cards as we go. A field still pointing at a young object
+   * afterwards dirties its card again through the write barrier. */
+  void BakerGC::scan_cards(Object* obj) {
+    Tuple* tup = as<Tuple>(obj);
+    MarkSweepGC::Page* page = MarkSweepGC::Page::of(tup);
+    Object** first = tup->field;
+    Object** last = tup->field + tup->num_fields();
+    size_t slots = MarkSweepGC::cCardSize / sizeof(Object*);
+
+    page->dirty = false;
+
+    for(size_t card = 0; card < page->card_count(); card++) {
+      if(!page->cards[card]) continue;
+      page->cards[card] = 0;
+
+      Object** pos = page->card_start(card);
+      Object** stop = pos + slots;
+      if(pos < first) pos = first;
+      if(stop > last) stop = last;
+
+      for(; pos < stop; pos++) {
+        Object* tmp = *pos;
+        if(!tmp->reference_p()) continue;
+
+        tmp = saw_object(tmp);
+        if(tmp) {
+          *pos = tmp;
+          object_memory->write_barrier(tup, pos, tmp);
+        }
+      }
+    }
+  }
+
   bool BakerGC::fully_scanned_p() {
     return next->fully_scanned_p();
   }
@@ -75,6 +122,10 @@ namespace rubinius {
 
     object_memory->remember_set = new ObjectArray(0);
     total_objects = 0;
+    // Only what was allocated since the last collection, not what it
+    // left behind.
+    allocated_bytes = current->used() - survivor_bytes;
+    promoted_bytes = 0;
 
     // Tracks all objects that we promoted during this run, so
     // we can scan them at the end.
@@ -87,7 +138,7 @@ namespace rubinius {
       // unremember_object throws a NULL in to remove an object
       // so we don't have to compact the set in unremember
       if(tmp) {
-        assert(tmp->zone == MatureObjectZone);
+        assert(tmp->mature_object_p());
         assert(!tmp->forwarded_p());
 
         /* Remove the Remember bit, since we're clearing the set. */
@@ -98,6 +149,18 @@ namespace rubinius {
 
     delete current_rs;
 
+    ObjectArray *current_cs = object_memory->card_set;
+    object_memory->card_set = new ObjectArray(0);
+
+    for(ObjectArray::iterator oi = current_cs->begin();
+        oi != current_cs->end();
+        oi++) {
+      // Dead objects are NULL'd out by the mature collector
+      if(*oi) scan_cards(*oi);
+    }
+
+    delete current_cs;
+
     Root* root = static_cast<Root*>(roots.head());
     while(root) {
       tmp = root->get();
@@ -131,7 +194,7 @@ namespace rubinius {
             oi != cur->end();
             oi++) {
           tmp = *oi;
-          assert(tmp->zone == MatureObjectZone);
+          assert(tmp->mature_object_p());
           scan_object(tmp);
         }
 
@@ -160,11 +223,55 @@ namespace rubinius {
     /* Check any weakrefs and replace dead objects with nil*/
     clean_weakrefs();
 
+    /* Point the method cache at the new copies while the forwarding
+     * pointers are still around. */
+    object_memory->state->global_cache->forward_entries();
+
+    copied_bytes = next->used();
+
     /* Swap the 2 halves */
     Heap *x = next;
     next = current;
     current = x;
     next->reset();
+    survivor_bytes = current->used();
+
+    if(adaptive) adapt();
+
+    /* The empty half can take on a new size right away, the other
+     * follows after the next collection. */
+    if(next->size != desired_bytes) next->resize(desired_bytes);
+  }
+
+  /* Tune the tenuring age and semispace size from how much survived the
+   * last collection.
+   *
+   * If the survivors are filling up the semispace, objects get promoted
+   * sooner, and if hardly anything is left in it while plenty is being
+   * promoted, they stay young longer.
+   *
+   * If more than target_survival percent of what was allocated survived,
+   * the semispaces grow to give objects more time to die. If much less
+   * survived, they shrink back down. */
+  void BakerGC::adapt() {
+    if(allocated_bytes == 0) return;
+
+    size_t survived = copied_bytes + promoted_bytes;
+
+    if(copied_bytes > current->size / 2) {
+      if(lifetime > 1) lifetime--;
+    } else if(copied_bytes < current->size / 8 && promoted_bytes > copied_bytes) {
+      // age is only 3 bits wide
+      if(lifetime < 7) lifetime++;
+    }
+
+    size_t rate = survived * 100 / allocated_bytes;
+
+    if(rate > target_survival) {
+      if(desired_bytes * 2 <= max_bytes) desired_bytes *= 2;
+    } else if(rate < target_survival / 4) {
+      if(desired_bytes / 2 >= min_bytes) desired_bytes /= 2;
+    }
   }
 
   Object* BakerGC::next_object(Object* obj) {
@@ -26,6 +26,19 @@ namespace rubinius {
     size_t lifetime;
     size_t total_objects;
 
+    /* Stats for the last collection */
+    size_t survivor_bytes;
+    size_t allocated_bytes;
+    size_t copied_bytes;
+    size_t promoted_bytes;
+
+    /* Config variables */
+    bool   adaptive;
+    size_t desired_bytes;
+    size_t min_bytes;
+    size_t max_bytes;
+    size_t target_survival;
+
     /* Inline methods */
     Object* allocate(size_t fields, bool *collect_now) {
       size_t bytes = SIZE_IN_BYTES_FIELDS(fields);
@@ -61,12 +74,14 @@ namespace rubinius {
     void free_objects();
     virtual Object* saw_object(Object* obj);
     void    copy_unscanned();
+    void    scan_cards(Object* obj);
     bool    fully_scanned_p();
     void    collect(Roots &roots);
     void    clear_marks();
     Object*  next_object(Object* obj);
     void    find_lost_souls();
     void    clean_weakrefs();
+    void    adapt();
 
     ObjectPosition validate_object(Object* obj);
   };
@@ -0,0 +1,121 @@
+#include "gc.hpp"
+#include "gc_compact.hpp"
+#include "objectmemory.hpp"
+#include "global_cache.hpp"
+
+#include "vm/object_utils.hpp"
+
+#include "builtin/class.hpp"
+#include "builtin/tuple.hpp"
+
+namespace rubinius {
+
+  MatureCompactor::MatureCompactor(ObjectMemory* om)
+    : GarbageCollector(om)
+  { }
+
+  MatureCompactor::~MatureCompactor() {
+    if(weak_refs) delete weak_refs;
+  }
+
+  Object* MatureCompactor::saw_object(Object* obj) {
+    if(obj->forwarded_p()) return obj->forward();
+    return NULL;
+  }
+
+  /* Evacuate the sparse mature Pages if more than compact_threshold
+   * percent of the mature slot space is free, and fix up every reference
+   * to a moved object. The last mature collection must have been swept.
+   * With +marked+ set, the marks it left tell the live young objects and
+   * contexts apart; otherwise a young collection has just run, and every
+   * young object is live. Returns the number of bytes given back. */
+  size_t MatureCompactor::compact(Roots& roots, bool marked) {
+    MarkSweepGC& mature = object_memory->mature;
+
+    // Pages kept around for debugging must stay where they are.
+    if(!mature.release_pages) return 0;
+
+    if(mature.fragmentation() < mature.compact_threshold) return 0;
+
+    if(!mature.evacuate()) return 0;
+
+    fix_roots(roots);
+    fix_remember_set();
+
+    fix_heap(*object_memory->young.current, marked);
+    fix_heap(*object_memory->young.next, marked);
+    fix_heap(object_memory->contexts, marked);
+
+    mature.scan_objects(*this);
+    fix_weak_refs();
+
+    // The GlobalCache isn't scanned, and its entries may refer to dead
+    // objects, which can't be read to see if they moved. Drop them all.
+    object_memory->state->global_cache->clear();
+
+    return mature.release_evacuated();
+  }
+
+  void MatureCompactor::fix_roots(Roots& roots) {
+    Root* root = static_cast<Root*>(roots.head());
+    while(root) {
+      Object* tmp = root->get();
+      if(tmp->reference_p() && tmp->forwarded_p()) {
+        root->set(tmp->forward());
+      }
+
+      root = static_cast<Root*>(root->next());
+    }
+  }
+
+  /* The card set only holds large objects, which never move. */
+  void MatureCompactor::fix_remember_set() {
+    ObjectArray* rs = object_memory->remember_set;
+
+    for(ObjectArray::iterator oi = rs->begin(); oi != rs->end(); oi++) {
+      if(*oi && (*oi)->forwarded_p()) *oi = (*oi)->forward();
+    }
+  }
+
+  /* Scan the objects in +heap+ that the last mature mark found live, or
+   * all of them without +marked+. */
+  void MatureCompactor::fix_heap(Heap& heap, bool marked) {
+    Object* obj = heap.first_object();
+    while(obj < heap.current) {
+      if(!marked || obj->marked_p()) scan_object(obj);
+      obj = (Object*)((uintptr_t)obj + obj->size_in_bytes());
+    }
+  }
+
+  /* scan_object() only collects objects with weak refs, so fix them up
+   * here. The mature collection already cleared any dead refs. */
+  void MatureCompactor::fix_weak_refs() {
+    if(!weak_refs) return;
+
+    for(ObjectArray::iterator i = weak_refs->begin();
+        i != weak_refs->end();
+        i++) {
+      // ATM, only a Tuple can be marked weak.
+      Tuple* tup = as<Tuple>(*i);
+      Object* tmp;
+
+      if(tup->klass() && tup->klass()->reference_p()) {
+        if((tmp = saw_object(tup->klass()))) object_memory->set_class(tup, tmp);
+      }
+
+      if(tup->ivars() && tup->ivars()->reference_p()) {
+        if((tmp = saw_object(tup->ivars()))) tup->ivars(object_memory->state, tmp);
+      }
+
+      for(size_t ti = 0; ti < tup->num_fields(); ti++) {
+        tmp = tup->field[ti];
+        if(!tmp->reference_p()) continue;
+
+        if((tmp = saw_object(tmp))) tup->field[ti] = tmp;
+      }
+    }
+
+    delete weak_refs;
+    weak_refs = NULL;
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef RBX_GC_COMPACT_HPP
+#define RBX_GC_COMPACT_HPP
+
+#include "gc.hpp"
+#include "gc_root.hpp"
+
+namespace rubinius {
+
+  /* Forwards */
+  class Object;
+  class ObjectMemory;
+  class Heap;
+
+
+  /* Compacts the mature generation once it has become fragmented enough.
+   *
+   * MarkSweepGC::evacuate() moves the objects out of sparse Pages, and
+   * the references to them are then fixed up the same way a collection
+   * finds them: every live object is scanned with ObjectMark and its
+   * TypeInfo, and saw_object() answers the new address of anything that
+   * moved, which the mark functions store back.
+   *
+   * It runs straight after a mature mark, while the Marked bits still tell
+   * the live young objects and contexts apart from the dead ones, if that
+   * collection has already been swept. Otherwise it runs after the first
+   * young collection once the sweep is done, when every young object is
+   * live. */
+  class MatureCompactor : public GarbageCollector {
+  public:
+
+    /* Prototypes */
+    MatureCompactor(ObjectMemory* om);
+    virtual ~MatureCompactor();
+
+    virtual Object* saw_object(Object* obj);
+    size_t compact(Roots& roots, bool marked);
+
+  private:
+    void fix_roots(Roots& roots);
+    void fix_remember_set();
+    void fix_heap(Heap& heap, bool marked);
+    void fix_weak_refs();
+  };
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "gc.hpp"
 #include "gc_marksweep.hpp"
+#include "gc_parallel_mark.hpp"
 #include "objectmemory.hpp"
 
 #include "vm/object_utils.hpp"
@@ -7,82 +8,297 @@
 #include "builtin/tuple.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 namespace rubinius {
 
-  MarkSweepGC::Entry::Entry(Header* h, size_t b, size_t f) {
-    bytes = b;
-    fields = f;
-    marked = false;
-    header = h;
+  void MarkSweepGC::Page::clear_marks() {
+    std::memset(marks, 0, sizeof(marks));
   }
 
   MarkSweepGC::MarkSweepGC(ObjectMemory *om)
               :GarbageCollector(om) {
+    large_pages = NULL;
     allocated_objects = 0;
     allocated_bytes = 0;
+    page_bytes = 0;
     next_collection_bytes = MS_COLLECTION_BYTES;
-    free_entries = true;
+    release_pages = true;
+    sweep_pending = false;
+    swept_objects = 0;
+    swept_bytes = 0;
+    sweeper_running = false;
+    sweeper_exit = false;
+    lazy_sweep = false;
+    background_sweep = false;
+    sweep_slice_pages = 8;
+    mark_threads = 1;
+    evacuated_pages = NULL;
+    compactions = 0;
+    compacted_bytes = 0;
+    compact_threshold = 0;
+    sweep_class = 0;
+    large_sweep_link = NULL;
+
+    pthread_mutex_init(&sweep_lock, NULL);
+    pthread_cond_init(&sweep_cond, NULL);
+
+    /* Size classes go up a word at a time for small objects, then
+     * by roughly a quarter of their size until cMaxSlotBytes. */
+    size_t size = sizeof(ObjectHeader);
+    while(size < cMaxSlotBytes) {
+      size_classes.push_back(SizeClass(size));
+
+      size_t step = size < 512 ? SIZE_OF_OBJECT :
+                      (size / 4) & ~(SIZE_OF_OBJECT - 1);
+      size += step;
+    }
+    size_classes.push_back(SizeClass(cMaxSlotBytes));
+
+    /* Map a size in words to the smallest size class that fits it. */
+    size_t max_words = cMaxSlotBytes / SIZE_OF_OBJECT;
+    size_t idx = 0;
+    class_index.resize(max_words + 1);
+
+    for(size_t words = 0; words <= max_words; words++) {
+      while(size_classes[idx].slot_size < words * SIZE_OF_OBJECT) idx++;
+      class_index[words] = idx;
+    }
   }
 
   MarkSweepGC::~MarkSweepGC() {
-    std::list<Entry*>::iterator i;
+    free_objects();
 
-    for(i = entries.begin(); i != entries.end(); i++) {
-      delete *i;
-    }
+    pthread_cond_destroy(&sweep_cond);
+    pthread_mutex_destroy(&sweep_lock);
   }
 
+  /* Release every Page without running any object cleanup. */
   void MarkSweepGC::free_objects() {
-    std::list<Entry*>::iterator i;
+    stop_sweeper();
+
+    for(std::vector<SizeClass>::iterator i = size_classes.begin();
+        i != size_classes.end();
+        i++) {
+      Page* page = i->pages;
+      while(page) {
+        Page* next = page->next;
+        release_page(page);
+        page = next;
+      }
+
+      i->pages = NULL;
+      i->free_list = NULL;
+      i->swept_list = NULL;
+      i->sweep_link = NULL;
+    }
+
+    Page* page = large_pages;
+    while(page) {
+      Page* next = page->next;
+      release_page(page);
+      page = next;
+    }
+
+    large_pages = NULL;
+    large_sweep_link = NULL;
+
+    page = evacuated_pages;
+    while(page) {
+      Page* next = page->next;
+      release_page(page);
+      page = next;
+    }
+
+    evacuated_pages = NULL;
+    sweep_pending = false;
+    allocated_objects = 0;
+    allocated_bytes = 0;
+  }
+
+  /* Map +bytes+ (a multiple of the OS page size) aligned on cPageSize.
+   * We ask for cPageSize more than needed and hand back the ends. */
+  static void* map_aligned(size_t bytes) {
+    size_t total = bytes + MarkSweepGC::cPageSize;
+
+    void* mem = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANON, -1, 0);
+    if(mem == MAP_FAILED) return NULL;
+
+    uintptr_t start = (uintptr_t)mem;
+    uintptr_t aligned = (start + MarkSweepGC::cPageSize - 1) &
+                        ~(uintptr_t)(MarkSweepGC::cPageSize - 1);
+
+    if(aligned > start) munmap(mem, aligned - start);
+
+    uintptr_t end = aligned + bytes;
+    uintptr_t map_end = start + total;
+    if(map_end > end) munmap((void*)end, map_end - end);
+
+    return (void*)aligned;
+  }
+
+  /* Large objects get a Page of their own, mapped straight from the OS so
+   * they stay out of the malloc heap and the memory goes back as soon as
+   * the object is swept. Small Pages come from posix_memalign. */
+  MarkSweepGC::Page* MarkSweepGC::new_page(size_t slot_size, size_t bytes) {
+    void* mem;
+    bool large = slot_size > cMaxSlotBytes;
+
+    if(large) {
+      size_t os_page = getpagesize();
+      bytes = (bytes + os_page - 1) & ~(os_page - 1);
+      mem = map_aligned(bytes);
+    } else if(posix_memalign(&mem, cPageSize, bytes) != 0) {
+      mem = NULL;
+    }
+
+    if(!mem) {
+      std::cerr << "Unable to allocate mature page of " << bytes << " bytes\n";
+      abort();
+    }
+
+    Page* page = (Page*)mem;
+    page->next = NULL;
+    page->slot_size = slot_size;
+    page->slot_count = (bytes - sizeof(Page)) / slot_size;
+    page->bytes = bytes;
+    page->unswept = false;
+    page->dirty = false;
+    page->clear_marks();
+    std::memset(page->allocated, 0, sizeof(page->allocated));
+
+    page->cards = NULL;
+    if(large) {
+      page->cards = (unsigned char*)calloc(page->card_count(), 1);
+    }
+
+    page_bytes += bytes;
 
-    for(i = entries.begin(); i != entries.end(); i++) {
-      free_object(*i, true);
+    return page;
+  }
+
+  void MarkSweepGC::release_page(Page* page) {
+    page_bytes -= page->bytes;
+
+    if(page->large_p()) {
+      free(page->cards);
+      munmap(page, page->bytes);
+    } else {
+      free(page);
+    }
+  }
+
+  /* Add a fresh Page to +sc+ and thread all its slots onto the free
+   * list, lowest address first. */
+  void MarkSweepGC::add_page(SizeClass& sc) {
+    Page* page = new_page(sc.slot_size, cPageSize);
+    page->next = sc.pages;
+    sc.pages = page;
+
+    for(size_t i = page->slot_count; i > 0; i--) {
+      Object* obj = page->object_at(i - 1);
+      set_next_free(obj, sc.free_list);
+      sc.free_list = obj;
     }
   }
 
   Object* MarkSweepGC::allocate(size_t fields, bool *collect_now) {
     size_t bytes;
     Object* obj;
+    Page* page;
 
-    bytes = sizeof(Header) + SIZE_IN_BYTES_FIELDS(fields);
+    bytes = SIZE_IN_BYTES_FIELDS(fields);
 
-    // std::cout << "ms: " << bytes << ", fields: " << fields << "\n";
+    if(bytes > cMaxSlotBytes) {
+      pthread_mutex_lock(&sweep_lock);
+      page = new_page(bytes, sizeof(Page) + bytes);
+      page->next = large_pages;
+      large_pages = page;
+      pthread_mutex_unlock(&sweep_lock);
 
-    Header *header = (Header*)malloc(bytes);
-    Entry *entry = new Entry(header, bytes, fields);
-    header->entry = entry;
+      obj = page->first_object();
+    } else {
+      SizeClass& sc = size_classes[class_index[bytes / SIZE_OF_OBJECT]];
 
-    entries.push_back(entry);
+      if(!sc.free_list) refill(sc);
+
+      obj = sc.free_list;
+      sc.free_list = next_free(obj);
+
+      page = Page::of(obj);
+      bytes = sc.slot_size;
+    }
+
+    page->set_allocated(obj);
 
     allocated_objects++;
     allocated_bytes += bytes;
 
     next_collection_bytes -= bytes;
-    if(next_collection_bytes < 0) {
+    if(next_collection_bytes <= 0) {
       *collect_now = true;
       next_collection_bytes = MS_COLLECTION_BYTES;
     }
 
-    obj = header->to_object();
-
-    obj->init_header(MatureObjectZone, fields);
+    obj->init_header(page->large_p() ? LargeObjectZone : MatureObjectZone, fields);
 
     return obj;
   }
 
-  void MarkSweepGC::free_object(Entry *entry, bool fast) {
+  /* Fill the empty free list of +sc+, preferring slots the sweeper has
+   * already handed over, then sweeping Pages of +sc+ ourselves, and only
+   * then asking for a new Page. */
+  void MarkSweepGC::refill(SizeClass& sc) {
+    pthread_mutex_lock(&sweep_lock);
+
+    while(!sc.swept_list && sweep_next_page(sc)) ;
+
+    if(sc.swept_list) {
+      sc.free_list = sc.swept_list;
+      sc.swept_list = NULL;
+    } else {
+      add_page(sc);
+    }
+
+    account_swept();
+    pthread_mutex_unlock(&sweep_lock);
+  }
+
+  /* Run +obj+'s cleanup and give its slot back to the Page. */
+  void MarkSweepGC::reclaim_object(Object* obj, bool fast) {
     if(!fast) {
-      delete_object(entry->header->to_object());
+      delete_object(obj);
     }
 
-    allocated_objects--;
-    allocated_bytes -= entry->bytes;
+    Page::of(obj)->clear_allocated(obj);
 
     // A debugging tag to see if we try to use a free'd object
-    entry->header->to_object()->IsMeta = 1;
+    obj->IsMeta = 1;
+  }
+
+  void MarkSweepGC::free_object(Object* obj, bool fast) {
+    reclaim_object(obj, fast);
+
+    allocated_objects--;
+    allocated_bytes -= Page::of(obj)->slot_size;
+  }
 
-    free(entry->header);
+  /* The sweeper can't touch the allocation counts, since the allocator
+   * updates them without holding sweep_lock. It totals up what it frees
+   * instead, and the allocator takes that off whenever it has the lock. */
+  void MarkSweepGC::account_swept() {
+    allocated_objects -= swept_objects;
+    allocated_bytes -= swept_bytes;
+    swept_objects = 0;
+    swept_bytes = 0;
   }
 
   Object* MarkSweepGC::copy_object(Object* orig) {
@@ -95,9 +311,8 @@ namespace rubinius {
     return obj;
   }
 
-  MarkSweepGC::Entry *MarkSweepGC::find_entry(Object* obj) {
-    Header *header = (Header*)((uintptr_t)obj - sizeof(Header));
-    return header->entry;
+  bool MarkSweepGC::marked_p(Object* obj) {
+    return Page::of(obj)->marked_p(obj);
   }
 
   Object* MarkSweepGC::saw_object(Object* obj) {
@@ -106,20 +321,37 @@ namespace rubinius {
 
       obj->mark();
     } else {
-      Entry *entry = find_entry(obj);
-      if(entry->marked_p()) return NULL;
+      Page* page = Page::of(obj);
+      if(page->marked_p(obj)) return NULL;
 
-      entry->mark();
+      page->mark(obj);
     }
 
-    /* Recurse down, scanning each object as we see it. */
-    scan_object(obj);
+    /* Scanned later by process_mark_stack(), rather than recursing. */
+    mark_stack.push_back(obj);
     return NULL;
   }
 
+  /* Scan everything on the mark stack, which pushes whatever the
+   * scanned objects reference that hasn't been marked yet. */
+  void MarkSweepGC::process_mark_stack() {
+    while(!mark_stack.empty()) {
+      Object* obj = mark_stack.back();
+      mark_stack.pop_back();
+
+      // Get the next object on the way while this one is scanned.
+      if(!mark_stack.empty()) prefetch(mark_stack.back());
+
+      scan_object(obj);
+    }
+  }
+
   void MarkSweepGC::collect(Roots &roots) {
     Object* tmp;
 
+    // Marking needs all the marks left by the last cycle cleared.
+    finish_sweep();
+
     Root* root = static_cast<Root*>(roots.head());
     while(root) {
       tmp = root->get();
@@ -130,39 +362,549 @@ namespace rubinius {
       root = static_cast<Root*>(root->next());
     }
 
+    if(mark_threads > 1) {
+      ParallelMark marker(this, mark_threads);
+      marker.mark(mark_stack);
+    } else {
+      process_mark_stack();
+    }
+
     // Cleanup all weakrefs seen
     clean_weakrefs();
 
-    // Sweep up the garbage
-    sweep_objects();
+    prune_remember_set();
+
+    // Sweep up the garbage, now, bit by bit later on, or on the
+    // sweeper thread.
+    pthread_mutex_lock(&sweep_lock);
+    start_sweep();
+    pthread_mutex_unlock(&sweep_lock);
+
+    if(background_sweep) {
+      start_sweeper();
+      pthread_cond_signal(&sweep_cond);
+    } else if(!lazy_sweep) {
+      finish_sweep();
+    }
   }
 
-  void MarkSweepGC::sweep_objects() {
-    std::list<Entry*>::iterator i;
+  /* Drop the dead objects from the remember set and card set now, while
+   * the mutator isn't running, so sweeping never has to search or change
+   * them. */
+  void MarkSweepGC::prune_remember_set() {
+    ObjectArray* rs = object_memory->remember_set;
+
+    for(ObjectArray::iterator oi = rs->begin(); oi != rs->end(); oi++) {
+      Object* obj = *oi;
+      if(!obj || !obj->mature_object_p() || marked_p(obj)) continue;
+
+      obj->Remember = 0;
+      *oi = NULL;
+    }
+
+    ObjectArray* cs = object_memory->card_set;
+
+    for(ObjectArray::iterator oi = cs->begin(); oi != cs->end(); oi++) {
+      if(*oi && !marked_p(*oi)) *oi = NULL;
+    }
+  }
+
+  static void* __sweeper_tramp__(void* arg) {
+    // Signals are for the main thread to deal with.
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    static_cast<MarkSweepGC*>(arg)->sweeper_loop();
+    return NULL;
+  }
+
+  void MarkSweepGC::start_sweeper() {
+    if(sweeper_running) return;
+
+    sweeper_exit = false;
+    if(pthread_create(&sweeper, NULL, __sweeper_tramp__, this) != 0) {
+      std::cerr << "Unable to create sweeper thread, sweeping lazily\n";
+      background_sweep = false;
+      lazy_sweep = true;
+      return;
+    }
+
+    sweeper_running = true;
+  }
+
+  void MarkSweepGC::stop_sweeper() {
+    if(!sweeper_running) return;
+
+    pthread_mutex_lock(&sweep_lock);
+    sweeper_exit = true;
+    pthread_cond_signal(&sweep_cond);
+    pthread_mutex_unlock(&sweep_lock);
+
+    pthread_join(sweeper, NULL);
+    sweeper_running = false;
+  }
+
+  /* Sweep a Page at a time whenever there is sweeping to do, letting go
+   * of sweep_lock between Pages so the allocator can get in. */
+  void MarkSweepGC::sweeper_loop() {
+    pthread_mutex_lock(&sweep_lock);
+
+    while(!sweeper_exit) {
+      if(!sweep_pending) {
+        pthread_cond_wait(&sweep_cond, &sweep_lock);
+        continue;
+      }
+
+      sweep_pages(1);
+
+      pthread_mutex_unlock(&sweep_lock);
+      sched_yield();
+      pthread_mutex_lock(&sweep_lock);
+    }
+
+    pthread_mutex_unlock(&sweep_lock);
+  }
+
+  /* Free every allocated but unmarked slot in +page+ and chain all of
+   * the page's free slots together into +head+ .. +tail+. Returns the
+   * number of live objects left in the page. */
+  size_t MarkSweepGC::sweep_page(Page* page, Object** head, Object** tail) {
+    size_t live = 0;
+
+    *head = *tail = NULL;
 
-    for(i = entries.begin(); i != entries.end();) {
-      if((*i)->unmarked_p()) {
-        free_object(*i);
-        if(free_entries) delete *i;
-        i = entries.erase(i);
+    for(size_t i = 0; i < page->slot_count; i++) {
+      Object* obj = page->object_at(i);
+
+      if(page->allocated_p(obj)) {
+        if(page->marked_p(obj)) {
+          live++;
+          continue;
+        }
+
+        reclaim_object(obj, false);
+        swept_objects++;
+        swept_bytes += page->slot_size;
+      }
+
+      set_next_free(obj, NULL);
+      if(*tail) {
+        set_next_free(*tail, obj);
       } else {
-        (*i)->clear();
-        i++;
+        *head = obj;
+      }
+      *tail = obj;
+    }
+
+    page->clear_marks();
+
+    return live;
+  }
+
+  /* Sweep the next Page of +sc+ that is waiting to be swept, then splice
+   * its free slots onto the swept list or give it back if it's empty.
+   * Returns false once there is nothing left to sweep in +sc+. */
+  bool MarkSweepGC::sweep_next_page(SizeClass& sc) {
+    Page** link = sc.sweep_link;
+    if(!link) return false;
+
+    // Pages added since the sweep started go on the front of the list
+    // and have nothing to sweep.
+    while(*link && !(*link)->unswept) link = &(*link)->next;
+
+    Page* page = *link;
+    if(!page) {
+      sc.sweep_link = NULL;
+      return false;
+    }
+
+    Object* head;
+    Object* tail;
+
+    size_t live = sweep_page(page, &head, &tail);
+    page->unswept = false;
+
+    if(live == 0 && release_pages) {
+      *link = page->next;
+      release_page(page);
+    } else {
+      if(head) {
+        set_next_free(tail, sc.swept_list);
+        sc.swept_list = head;
+      }
+
+      link = &page->next;
+    }
+
+    sc.sweep_link = link;
+    return true;
+  }
+
+  bool MarkSweepGC::sweep_next_large_page() {
+    Page** link = large_sweep_link;
+    if(!link) return false;
+
+    while(*link && !(*link)->unswept) link = &(*link)->next;
+
+    Page* page = *link;
+    if(!page) {
+      large_sweep_link = NULL;
+      return false;
+    }
+
+    Object* obj = page->first_object();
+    page->unswept = false;
+
+    if(page->allocated_p(obj) && page->marked_p(obj)) {
+      page->clear_marks();
+      large_sweep_link = &page->next;
+      return true;
+    }
+
+    if(page->allocated_p(obj)) {
+      reclaim_object(obj, false);
+      swept_objects++;
+      swept_bytes += page->slot_size;
+    }
+
+    if(release_pages) {
+      *link = page->next;
+      release_page(page);
+    } else {
+      link = &page->next;
+    }
+
+    large_sweep_link = link;
+    return true;
+  }
+
+  /* Flag every Page as waiting to be swept. The free lists are emptied,
+   * they are rebuilt from scratch as each Page is swept. */
+  void MarkSweepGC::start_sweep() {
+    for(std::vector<SizeClass>::iterator sc = size_classes.begin();
+        sc != size_classes.end();
+        sc++) {
+      for(Page* page = sc->pages; page; page = page->next) {
+        page->unswept = true;
+      }
+
+      sc->free_list = NULL;
+      sc->swept_list = NULL;
+      sc->sweep_link = &sc->pages;
+    }
+
+    for(Page* page = large_pages; page; page = page->next) {
+      page->unswept = true;
+    }
+
+    large_sweep_link = &large_pages;
+    sweep_class = 0;
+    sweep_pending = true;
+  }
+
+  /* Sweep at most +pages+ Pages, a linear scan over the Pages of each
+   * size class in turn and then the large Pages. */
+  void MarkSweepGC::sweep_slice(size_t pages) {
+    pthread_mutex_lock(&sweep_lock);
+    sweep_pages(pages);
+    account_swept();
+    pthread_mutex_unlock(&sweep_lock);
+  }
+
+  /* sweep_slice() for callers already holding sweep_lock. */
+  void MarkSweepGC::sweep_pages(size_t pages) {
+    while(sweep_pending) {
+      if(sweep_class < size_classes.size()) {
+        if(!sweep_next_page(size_classes[sweep_class])) {
+          sweep_class++;
+          continue;
+        }
+      } else if(!sweep_next_large_page()) {
+        sweep_pending = false;
+        break;
       }
+
+      if(--pages == 0) break;
+    }
+  }
+
+  /* Sweep whatever is left. With the sweeper running, this helps it
+   * along; both sweep a whole Page under sweep_lock, so once there are no
+   * Pages pending, they have all been swept. */
+  void MarkSweepGC::finish_sweep() {
+    pthread_mutex_lock(&sweep_lock);
+    while(sweep_pending) {
+      sweep_pages(sweep_slice_pages);
     }
+    account_swept();
+    pthread_mutex_unlock(&sweep_lock);
+  }
+
+  /* True once every Page of the last collection has been swept. Doesn't
+   * sweep anything itself. */
+  bool MarkSweepGC::sweep_done_p() {
+    pthread_mutex_lock(&sweep_lock);
+    bool done = !sweep_pending;
+    if(done) account_swept();
+    pthread_mutex_unlock(&sweep_lock);
+    return done;
+  }
+
+  void MarkSweepGC::sweep_objects() {
+    start_sweep();
+    finish_sweep();
   }
 
   ObjectPosition MarkSweepGC::validate_object(Object* obj) {
-    std::list<Entry*>::iterator i;
+    Page* target = Page::of(obj);
+    Page* found = NULL;
+
+    // The sweeper may be releasing Pages.
+    pthread_mutex_lock(&sweep_lock);
+
+    for(std::vector<SizeClass>::iterator sc = size_classes.begin();
+        !found && sc != size_classes.end();
+        sc++) {
+      for(Page* page = sc->pages; page; page = page->next) {
+        if(page == target) {
+          found = page;
+          break;
+        }
+      }
+    }
+
+    if(found) {
+      if(!found->contains_slot_p(obj)) found = NULL;
+    } else {
+      for(Page* page = large_pages; page; page = page->next) {
+        if(page == target && page->first_object() == obj) {
+          found = page;
+          break;
+        }
+      }
+    }
+
+    ObjectPosition pos = cUnknown;
+    if(found && found->allocated_p(obj)) pos = cMatureObject;
+
+    pthread_mutex_unlock(&sweep_lock);
+
+    return pos;
+  }
+
+  /* The number of objects allocated in +page+. */
+  static size_t live_slots(MarkSweepGC::Page* page) {
+    size_t live = 0;
+
+    for(size_t i = 0; i < MarkSweepGC::cBitmapWords; i++) {
+      live += __builtin_popcountl(page->allocated[i]);
+    }
+
+    return live;
+  }
+
+  /* The percentage of the slot space in size class Pages that is free.
+   * Pages waiting to be swept count their garbage as live. */
+  size_t MarkSweepGC::fragmentation() {
+    size_t capacity = 0;
+    size_t live = 0;
+
+    pthread_mutex_lock(&sweep_lock);
+
+    for(std::vector<SizeClass>::iterator sc = size_classes.begin();
+        sc != size_classes.end();
+        sc++) {
+      for(Page* page = sc->pages; page; page = page->next) {
+        capacity += page->slot_count * page->slot_size;
+        live += live_slots(page) * page->slot_size;
+      }
+    }
+
+    pthread_mutex_unlock(&sweep_lock);
+
+    if(capacity == 0) return 0;
+    return (capacity - live) * 100 / capacity;
+  }
+
+  /* Objects whose address is held outside of the object graph, by the
+   * interpreter or by C extensions, so they can't be moved. */
+  bool MarkSweepGC::pin_p(Object* obj) {
+    switch(obj->obj_type) {
+    case DataType:
+    case TaskType:
+    case MethodContextType:
+    case BlockContextType:
+    case NativeMethodContextType:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  /* Move the live objects of the sparsest Pages of +sc+ into the free
+   * slots of the densest ones, until the rest of the Pages are empty.
+   * Pages holding a pinned object always stay. Each moved object is left
+   * forwarded to its copy, and the emptied Pages go on evacuated_pages.
+   * Returns the number of bytes in the emptied Pages. */
+  size_t MarkSweepGC::evacuate_class(SizeClass& sc) {
+    typedef std::pair<size_t, Page*> Candidate;
+
+    std::vector<Page*> stay;
+    std::vector<Candidate> candidates;
+    size_t free_slots = 0;
+    size_t moving = 0;
+
+    for(Page* page = sc.pages; page; page = page->next) {
+      size_t live = live_slots(page);
+      bool pinned = false;
+
+      for(size_t i = 0; !pinned && i < page->slot_count; i++) {
+        Object* obj = page->object_at(i);
+        pinned = page->allocated_p(obj) && pin_p(obj);
+      }
+
+      if(pinned) {
+        stay.push_back(page);
+        free_slots += page->slot_count - live;
+      } else {
+        candidates.push_back(Candidate(live, page));
+        moving += live;
+      }
+    }
+
+    // Keep the densest Pages until there is room in them for the rest.
+    std::sort(candidates.begin(), candidates.end(), std::greater<Candidate>());
+
+    size_t first = 0;
+    while(first < candidates.size() && free_slots < moving) {
+      Page* page = candidates[first].second;
+      free_slots += page->slot_count - candidates[first].first;
+      moving -= candidates[first].first;
+      stay.push_back(page);
+      first++;
+    }
+
+    if(first == candidates.size()) return 0;
+
+    size_t bytes = 0;
+    size_t dest = 0;
+    size_t slot = 0;
+
+    for(size_t i = first; i < candidates.size(); i++) {
+      Page* page = candidates[i].second;
+
+      for(size_t j = 0; j < page->slot_count; j++) {
+        Object* obj = page->object_at(j);
+        if(!page->allocated_p(obj)) continue;
+
+        Object* copy;
+        for(;;) {
+          if(slot == stay[dest]->slot_count) {
+            dest++;
+            slot = 0;
+            continue;
+          }
+
+          copy = stay[dest]->object_at(slot++);
+          if(!stay[dest]->allocated_p(copy)) break;
+        }
 
-    for(i = entries.begin(); i != entries.end(); i++) {
-      Entry* entry = *i;
-      if(entry->header->to_object() == obj) {
-        return cMatureObject;
+        std::memcpy(copy, obj, sc.slot_size);
+        stay[dest]->set_allocated(copy);
+
+        // Forwarded the same way BakerGC does it.
+        obj->Forwarded = 1;
+        obj->klass_ = (Class*)copy;
+      }
+
+      page->next = evacuated_pages;
+      evacuated_pages = page;
+      bytes += page->bytes;
+    }
+
+    // Relink the Pages that stay, densest first, and rebuild the free
+    // list from their free slots.
+    sc.pages = NULL;
+    sc.free_list = NULL;
+    sc.swept_list = NULL;
+    sc.sweep_link = NULL;
+
+    for(size_t i = stay.size(); i > 0; i--) {
+      Page* page = stay[i - 1];
+      page->next = sc.pages;
+      sc.pages = page;
+
+      for(size_t j = page->slot_count; j > 0; j--) {
+        Object* obj = page->object_at(j - 1);
+        if(page->allocated_p(obj)) continue;
+
+        set_next_free(obj, sc.free_list);
+        sc.free_list = obj;
       }
     }
 
-    return cUnknown;
+    return bytes;
+  }
+
+  /* Compact every size class. The last collection must have been swept.
+   * Returns true if anything moved, in which case every reference to a
+   * moved object has to be fixed up before release_evacuated(). */
+  bool MarkSweepGC::evacuate() {
+    pthread_mutex_lock(&sweep_lock);
+    assert(!sweep_pending);
+
+    for(std::vector<SizeClass>::iterator sc = size_classes.begin();
+        sc != size_classes.end();
+        sc++) {
+      evacuate_class(*sc);
+    }
+
+    pthread_mutex_unlock(&sweep_lock);
+
+    return evacuated_pages != NULL;
+  }
+
+  /* Give back the Pages emptied by evacuate(). Returns the number of
+   * bytes reclaimed, which is also kept in compacted_bytes. */
+  size_t MarkSweepGC::release_evacuated() {
+    size_t bytes = 0;
+
+    pthread_mutex_lock(&sweep_lock);
+
+    while(evacuated_pages) {
+      Page* page = evacuated_pages;
+      evacuated_pages = page->next;
+
+      bytes += page->bytes;
+      release_page(page);
+    }
+
+    pthread_mutex_unlock(&sweep_lock);
+
+    compactions++;
+    compacted_bytes = bytes;
+
+    return bytes;
+  }
+
+  /* Have +gc+ scan every mature object. */
+  void MarkSweepGC::scan_objects(GarbageCollector& gc) {
+    for(std::vector<SizeClass>::iterator sc = size_classes.begin();
+        sc != size_classes.end();
+        sc++) {
+      for(Page* page = sc->pages; page; page = page->next) {
+        for(size_t i = 0; i < page->slot_count; i++) {
+          Object* obj = page->object_at(i);
+          if(page->allocated_p(obj)) gc.scan_object(obj);
+        }
+      }
+    }
+
+    for(Page* page = large_pages; page; page = page->next) {
+      Object* obj = page->first_object();
+      if(page->allocated_p(obj)) gc.scan_object(obj);
+    }
   }
 
   // HACK todo test this!
@@ -184,8 +926,7 @@ namespace rubinius {
             tup->field[ti] = Qnil;
           }
         } else {
-          Entry *entry = find_entry(obj);
-          if(!entry->marked_p()) {
+          if(!marked_p(obj)) {
             tup->field[ti] = Qnil;
           }
         }
@@ -5,7 +5,8 @@
 #include "gc_root.hpp"
 #include "object_position.hpp"
 
-#include <list>
+#include <vector>
+#include <pthread.h>
 
 #define MS_COLLECTION_BYTES 10485760
 
@@ -16,61 +17,179 @@ namespace rubinius {
   class ObjectMemory;
 
 
+  /* The mature generation. Objects are carved out of Pages, each of which
+   * holds slots of a single size class. Pages are aligned on cPageSize, so
+   * the Page (and therefore the mark bit) for an object is found with
+   * simple address arithmetic. Objects bigger than the largest size class
+   * get a Page of their own, mapped straight from the OS, and are in the
+   * LargeObjectZone.
+   *
+   * With lazy_sweep set, collect() only marks. The Pages are then swept a
+   * few at a time by sweep_slice(), or on demand when a size class runs
+   * out of free slots. The free lists only ever hold slots from Pages that
+   * have been swept, so new objects never land in a Page still waiting to
+   * be swept and can't be freed by mistake.
+   *
+   * With background_sweep set, the Pages are swept by a sweeper thread
+   * instead. Everything the sweeper and the allocator share is guarded by
+   * sweep_lock, which is held while a Page is swept. The sweeper hands the
+   * freed slots over through swept_list, and the allocator only takes the
+   * lock when its own free_list runs dry, so allocating from a free_list
+   * stays as cheap as before.
+   *
+   * Size class Pages that end up mostly empty can't be given back while a
+   * single object lives in them. Once more than compact_threshold percent
+   * of the slots in small Pages are free, the live objects of the
+   * sparsest Pages are packed into the free slots of the densest ones by
+   * evacuate(), leaving a forwarding pointer behind. ObjectMemory then has
+   * every reference fixed up (see MatureCompactor) before
+   * release_evacuated() hands the emptied Pages back. Large objects and
+   * the objects in pin_p() are never moved.
+   *
+   * Marking doesn't recurse. saw_object() marks an object and pushes it
+   * on mark_stack, and collect() pops and scans objects until the stack
+   * is empty, so deep object graphs (long Bucket chains, Lists) don't
+   * eat the C stack. */
   class MarkSweepGC : public GarbageCollector {
   public:
 
-    /* Utility classes */
-    class Header;
+    static const size_t cPageSize     = 65536;
+    static const size_t cMaxSlotBytes = 8192;
+    static const size_t cBitsPerWord  = sizeof(uintptr_t) * 8;
+    static const size_t cCardSize     = 512;
+
+    // One bit per word of a Page, so the bit index is just the word
+    // offset of the object in the Page.
+    static const size_t cBitmapWords  = cPageSize / sizeof(uintptr_t) / cBitsPerWord;
 
-    class Entry {
+    /* Utility classes */
+    class Page {
     public:
       /* Data members */
-      int bytes;
-      int fields;
-      bool marked;
-      Header *header;
+      Page* next;
+      size_t slot_size;
+      size_t slot_count;
+      size_t bytes;
+      bool unswept;
+      bool dirty;
+      unsigned char* cards;
+      uintptr_t marks[cBitmapWords];
+      uintptr_t allocated[cBitmapWords];
 
       /* Inline methods */
-      void mark() {
-        marked = true;
+
+      /* Returns the Page that +obj+ was allocated in. */
+      static Page* of(Object* obj) {
+        return (Page*)((uintptr_t)obj & ~(uintptr_t)(cPageSize - 1));
       }
 
-      void clear() {
-        marked = false;
+      static size_t bit_index(Object* obj) {
+        return ((uintptr_t)obj & (cPageSize - 1)) / sizeof(uintptr_t);
       }
 
-      bool marked_p() {
-        return marked;
+      Object* first_object() {
+        return (Object*)((uintptr_t)this + sizeof(Page));
       }
 
-      bool unmarked_p() {
-        return !marked;
+      Object* object_at(size_t slot) {
+        return (Object*)((uintptr_t)first_object() + slot * slot_size);
       }
 
-      /* Prototypes */
+      bool contains_slot_p(Object* obj) {
+        uintptr_t offset = (uintptr_t)obj - (uintptr_t)first_object();
+        if((uintptr_t)obj < (uintptr_t)first_object()) return false;
+        if(offset % slot_size != 0) return false;
+        return offset / slot_size < slot_count;
+      }
 
-      Entry(Header*, size_t bytes, size_t fields);
-    };
+      bool marked_p(Object* obj) {
+        size_t idx = bit_index(obj);
+        return (marks[idx / cBitsPerWord] >> (idx % cBitsPerWord)) & 1;
+      }
 
-    class Header {
-      public:
-      Entry *entry;
+      void mark(Object* obj) {
+        size_t idx = bit_index(obj);
+        marks[idx / cBitsPerWord] |= (uintptr_t)1 << (idx % cBitsPerWord);
+      }
 
-      /* Inline methods */
+      bool allocated_p(Object* obj) {
+        size_t idx = bit_index(obj);
+        return (allocated[idx / cBitsPerWord] >> (idx % cBitsPerWord)) & 1;
+      }
 
-      /* Returns the Object* that this is header for, using simple
-       * pointer math. */
-      Object* to_object() {
-        return (Object*)((uintptr_t)this + sizeof(Header));
+      void set_allocated(Object* obj) {
+        size_t idx = bit_index(obj);
+        allocated[idx / cBitsPerWord] |= (uintptr_t)1 << (idx % cBitsPerWord);
       }
+
+      void clear_allocated(Object* obj) {
+        size_t idx = bit_index(obj);
+        allocated[idx / cBitsPerWord] &= ~((uintptr_t)1 << (idx % cBitsPerWord));
+      }
+
+      void clear_marks();
+
+      bool large_p() {
+        return slot_size > cMaxSlotBytes;
+      }
+
+      /* Large Pages have a card table, one byte per cCardSize bytes of the
+       * Page, so a young collection only rescans the parts of a big Tuple
+       * that have been stored into. */
+      size_t card_count() {
+        return (bytes + cCardSize - 1) / cCardSize;
+      }
+
+      size_t card_index(Object** slot) {
+        return ((uintptr_t)slot - (uintptr_t)this) / cCardSize;
+      }
+
+      Object** card_start(size_t card) {
+        return (Object**)((uintptr_t)this + card * cCardSize);
+      }
+    };
+
+    class SizeClass {
+    public:
+      size_t slot_size;
+      Page* pages;
+      Object* free_list;
+      Object* swept_list;
+      Page** sweep_link;
+
+      SizeClass(size_t size) :
+        slot_size(size), pages(NULL), free_list(NULL), swept_list(NULL),
+        sweep_link(NULL) { }
     };
 
     /* Data members */
-    std::list<Entry*> entries;
+    std::vector<SizeClass> size_classes;
+    std::vector<unsigned char> class_index;
+    ObjectArray mark_stack;
+    Page*  large_pages;
     size_t allocated_bytes;
     size_t allocated_objects;
+    size_t page_bytes;
     int    next_collection_bytes;
-    bool   free_entries;
+    bool   release_pages;
+    bool   sweep_pending;
+    size_t swept_objects;
+    size_t swept_bytes;
+    pthread_mutex_t sweep_lock;
+    pthread_cond_t  sweep_cond;
+    pthread_t sweeper;
+    bool   sweeper_running;
+    bool   sweeper_exit;
+    Page*  evacuated_pages;
+    size_t compactions;
+    size_t compacted_bytes;
+
+    /* Config variables */
+    bool   lazy_sweep;
+    bool   background_sweep;
+    size_t sweep_slice_pages;
+    size_t mark_threads;
+    size_t compact_threshold;
 
     /* Prototypes */
 
@@ -79,14 +198,54 @@ namespace rubinius {
     void   free_objects();
     Object* allocate(size_t fields, bool *collect_now);
     Object* copy_object(Object* obj);
-    Entry *find_entry(Object* obj);
+    bool   marked_p(Object* obj);
     void   sweep_objects();
+    void   start_sweep();
+    void   sweep_slice(size_t pages);
+    void   finish_sweep();
+    bool   sweep_done_p();
     void   clean_weakrefs();
-    void   free_object(Entry *entry, bool fast = false);
+    void   free_object(Object* obj, bool fast = false);
     virtual Object* saw_object(Object* obj);
+    void   process_mark_stack();
     void   collect(Roots &roots);
+    void   start_sweeper();
+    void   stop_sweeper();
+    void   sweeper_loop();
+    size_t fragmentation();
+    bool   evacuate();
+    size_t release_evacuated();
+    void   scan_objects(GarbageCollector& gc);
+    static bool pin_p(Object* obj);
 
     ObjectPosition validate_object(Object* obj);
+
+  private:
+    Page*  new_page(size_t slot_size, size_t bytes);
+    void   release_page(Page* page);
+    void   add_page(SizeClass& sc);
+    void   refill(SizeClass& sc);
+    void   reclaim_object(Object* obj, bool fast);
+    void   account_swept();
+    void   sweep_pages(size_t pages);
+    void   prune_remember_set();
+    size_t sweep_page(Page* page, Object** head, Object** tail);
+    bool   sweep_next_page(SizeClass& sc);
+    bool   sweep_next_large_page();
+    size_t evacuate_class(SizeClass& sc);
+
+    size_t sweep_class;
+    Page** large_sweep_link;
+
+    // A free slot uses its class pointer to chain to the next free slot,
+    // the same way a forwarded object uses it to point at its copy.
+    static Object* next_free(Object* obj) {
+      return (Object*)obj->klass_;
+    }
+
+    static void set_next_free(Object* obj, Object* next) {
+      obj->klass_ = (Class*)next;
+    }
   };
 };
 
@@ -0,0 +1,258 @@
+#include "gc.hpp"
+#include "gc_marksweep.hpp"
+#include "gc_parallel_mark.hpp"
+#include "objectmemory.hpp"
+
+#include "optimize.hpp"
+
+#include <csignal>
+#include <sched.h>
+
+namespace rubinius {
+
+  /* Mark a young object. Returns false if it was already marked. The
+   * flags word is swapped in whole, with mark() applied to a copy of it,
+   * so only one worker sees the object go from unmarked to marked. */
+  static bool mark_header(Object* obj) {
+    for(;;) {
+      ObjectHeader hdr;
+      uint32_t old = hdr.all_flags = obj->all_flags;
+      if(hdr.marked_p()) return false;
+
+      hdr.mark();
+      if(__sync_bool_compare_and_swap(&obj->all_flags, old, hdr.all_flags)) {
+        return true;
+      }
+    }
+  }
+
+  /* Mark a mature object. Returns false if it was already marked. */
+  static bool mark_page(Object* obj) {
+    MarkSweepGC::Page* page = MarkSweepGC::Page::of(obj);
+    if(page->marked_p(obj)) return false;
+
+    size_t idx = MarkSweepGC::Page::bit_index(obj);
+    uintptr_t bit = (uintptr_t)1 << (idx % MarkSweepGC::cBitsPerWord);
+    uintptr_t old = __sync_fetch_and_or(&page->marks[idx / MarkSweepGC::cBitsPerWord], bit);
+    return !(old & bit);
+  }
+
+  ParallelMark::Worker::Worker(ParallelMark* owner, size_t id)
+    : GarbageCollector(owner->gc->object_memory)
+    , owner(owner)
+    , id(id)
+    , shared_size(0)
+    , scanned(0)
+  {
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  ParallelMark::Worker::~Worker() {
+    pthread_mutex_destroy(&lock);
+    if(weak_refs) delete weak_refs;
+  }
+
+  Object* ParallelMark::Worker::saw_object(Object* obj) {
+    if(obj->young_object_p()) {
+      if(!mark_header(obj)) return NULL;
+    } else {
+      if(!mark_page(obj)) return NULL;
+    }
+
+    push(obj);
+    return NULL;
+  }
+
+  /* Push +obj+ on the private stack. If the shared deque is running dry
+   * and there's plenty here, hand a batch over so others can steal it. */
+  void ParallelMark::Worker::push(Object* obj) {
+    stack.push_back(obj);
+
+    if(shared_size < cBatchSize && stack.size() >= cBatchSize * 2) {
+      pthread_mutex_lock(&lock);
+      for(size_t i = 0; i < cBatchSize; i++) {
+        shared.push_back(stack.back());
+        stack.pop_back();
+      }
+      shared_size = shared.size();
+      pthread_mutex_unlock(&lock);
+    }
+  }
+
+  /* The next object to scan, taken from the private stack, then from our
+   * own shared deque, then stolen from someone else's. */
+  Object* ParallelMark::Worker::next() {
+    if(stack.empty()) {
+      if(shared_size > 0) {
+        pthread_mutex_lock(&lock);
+        for(size_t i = 0; i < cBatchSize && !shared.empty(); i++) {
+          stack.push_back(shared.back());
+          shared.pop_back();
+        }
+        shared_size = shared.size();
+        pthread_mutex_unlock(&lock);
+      }
+
+      if(stack.empty() && !steal()) return NULL;
+    }
+
+    Object* obj = stack.back();
+    stack.pop_back();
+
+    if(!stack.empty()) prefetch(stack.back());
+    return obj;
+  }
+
+  /* Take up to half of another Worker's shared deque, oldest entries
+   * first, since those are the most likely to lead to more work. */
+  bool ParallelMark::Worker::steal() {
+    size_t count = owner->workers.size();
+
+    for(size_t i = 1; i < count; i++) {
+      Worker* victim = owner->workers[(id + i) % count];
+      if(victim->shared_size == 0) continue;
+
+      pthread_mutex_lock(&victim->lock);
+      size_t take = (victim->shared.size() + 1) / 2;
+      if(take > cBatchSize) take = cBatchSize;
+
+      for(size_t j = 0; j < take; j++) {
+        stack.push_back(victim->shared.front());
+        victim->shared.pop_front();
+      }
+      victim->shared_size = victim->shared.size();
+      pthread_mutex_unlock(&victim->lock);
+
+      if(take > 0) return true;
+    }
+
+    return false;
+  }
+
+  void ParallelMark::Worker::scan(Object* obj) {
+    scanned++;
+
+    if(serial_p(obj)) {
+      pthread_mutex_lock(&owner->serial_lock);
+      scan_object(obj);
+      pthread_mutex_unlock(&owner->serial_lock);
+    } else {
+      scan_object(obj);
+    }
+  }
+
+  /* Mark until there is no work left anywhere. A Worker with nothing to do
+   * counts itself idle, and rejoins if work shows up in a shared deque.
+   * Once every Worker is idle there can't be any work left, since only
+   * busy Workers push. */
+  void ParallelMark::Worker::run() {
+    for(;;) {
+      while(Object* obj = next()) {
+        scan(obj);
+      }
+
+      __sync_fetch_and_add(&owner->idle, 1);
+
+      for(;;) {
+        if(owner->idle == owner->workers.size()) return;
+
+        if(owner->work_available_p()) {
+          __sync_fetch_and_sub(&owner->idle, 1);
+          break;
+        }
+
+        sched_yield();
+      }
+    }
+  }
+
+  static void* __worker_tramp__(void* arg) {
+    // Signals are for the main thread to deal with.
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    static_cast<ParallelMark::Worker*>(arg)->run();
+    return NULL;
+  }
+
+  ParallelMark::ParallelMark(MarkSweepGC* gc, size_t threads)
+    : gc(gc)
+    , idle(0)
+  {
+    pthread_mutex_init(&serial_lock, NULL);
+
+    if(threads < 1) threads = 1;
+    for(size_t i = 0; i < threads; i++) {
+      workers.push_back(new Worker(this, i));
+    }
+  }
+
+  ParallelMark::~ParallelMark() {
+    for(std::vector<Worker*>::iterator i = workers.begin(); i != workers.end(); i++) {
+      delete *i;
+    }
+
+    pthread_mutex_destroy(&serial_lock);
+  }
+
+  /* Whether a kind of object has to be scanned while holding serial_lock. */
+  bool ParallelMark::serial_p(Object* obj) {
+    switch(obj->obj_type) {
+    case DataType:
+    case TaskType:
+    case MethodContextType:
+    case BlockContextType:
+    case NativeMethodContextType:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  bool ParallelMark::work_available_p() {
+    for(std::vector<Worker*>::iterator i = workers.begin(); i != workers.end(); i++) {
+      if((*i)->shared_size > 0) return true;
+    }
+
+    return false;
+  }
+
+  /* Mark everything reachable from the already marked objects in +seed+,
+   * which is left empty. The calling thread acts as the first Worker. */
+  void ParallelMark::mark(ObjectArray& seed) {
+    size_t count = workers.size();
+
+    for(size_t i = 0; i < seed.size(); i++) {
+      Worker* worker = workers[i % count];
+      worker->shared.push_back(seed[i]);
+      worker->shared_size = worker->shared.size();
+    }
+    seed.clear();
+
+    size_t started = 1;
+    for(; started < count; started++) {
+      Worker* worker = workers[started];
+      if(pthread_create(&worker->thread, NULL, __worker_tramp__, worker) != 0) break;
+    }
+
+    // If some threads couldn't be created, their share gets stolen.
+    if(started < count) __sync_fetch_and_add(&idle, count - started);
+
+    workers[0]->run();
+
+    for(size_t i = 1; i < started; i++) {
+      pthread_join(workers[i]->thread, NULL);
+    }
+
+    // Hand over the weakrefs the Workers came across.
+    for(std::vector<Worker*>::iterator i = workers.begin(); i != workers.end(); i++) {
+      Worker* worker = *i;
+      if(!worker->weak_refs) continue;
+
+      if(!gc->weak_refs) gc->weak_refs = new ObjectArray(0);
+      gc->weak_refs->insert(gc->weak_refs->end(),
+                            worker->weak_refs->begin(), worker->weak_refs->end());
+    }
+  }
+}
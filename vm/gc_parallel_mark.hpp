@@ -0,0 +1,73 @@
+#ifndef RBX_GC_PARALLEL_MARK_HPP
+#define RBX_GC_PARALLEL_MARK_HPP
+
+#include "gc.hpp"
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+namespace rubinius {
+
+  /* Forwards */
+  class Object;
+  class MarkSweepGC;
+
+
+  /* Runs the mark phase of a mature collection on several threads.
+   *
+   * Each Worker marks into a private stack, handing a batch over to its
+   * shared deque whenever that runs low. A Worker that runs out of work
+   * steals from the shared deques of the others. Mark bits are set with
+   * atomic operations, so the Worker that sets the bit is the only one
+   * that scans the object.
+   *
+   * A few kinds of objects have mark functions that touch VM wide state
+   * (Data sets the current ObjectMark, contexts add themselves to the
+   * remember set). Those are scanned while holding serial_lock. */
+  class ParallelMark {
+  public:
+
+    static const size_t cBatchSize = 32;
+
+    class Worker : public GarbageCollector {
+    public:
+      /* Data members */
+      ParallelMark* owner;
+      size_t id;
+      ObjectArray stack;
+      std::deque<Object*> shared;
+      volatile size_t shared_size;
+      pthread_mutex_t lock;
+      pthread_t thread;
+      size_t scanned;
+
+      /* Prototypes */
+      Worker(ParallelMark* owner, size_t id);
+      virtual ~Worker();
+
+      virtual Object* saw_object(Object* obj);
+      void    push(Object* obj);
+      Object* next();
+      bool    steal();
+      void    scan(Object* obj);
+      void    run();
+    };
+
+    /* Data members */
+    MarkSweepGC* gc;
+    std::vector<Worker*> workers;
+    volatile size_t idle;
+    pthread_mutex_t serial_lock;
+
+    /* Prototypes */
+    ParallelMark(MarkSweepGC* gc, size_t threads);
+    ~ParallelMark();
+
+    void mark(ObjectArray& seed);
+    bool work_available_p();
+    static bool serial_p(Object* obj);
+  };
+};
+
+#endif
@@ -1,16 +1,50 @@
 #ifndef RBX_VM_GLOBAL_CACHE_HPP
 #define RBX_VM_GLOBAL_CACHE_HPP
 
+#include "vm/vm.hpp"
 #include "vm/object_utils.hpp"
 
 #include "builtin/compiledmethod.hpp"
 #include "builtin/methodvisibility.hpp"
+#include "builtin/module.hpp"
+
+#include <vector>
 
 namespace rubinius {
   #define CPU_CACHE_SIZE 0x1000
-  #define CPU_CACHE_MASK 0xfff
-  #define CPU_CACHE_HASH(c,m) ((((uintptr_t)(c)>>3)^((uintptr_t)m)) & CPU_CACHE_MASK)
+  #define CPU_CACHE_WAYS 4
+  #define CPU_CACHE_HASH(c,m) ((uintptr_t)(c)^((uintptr_t)(m)>>3))
 
+  /* Maps a class and method name to the method found by looking up the
+   * name starting at that class.
+   *
+   * The cache is CPU_CACHE_WAYS-way set associative. A class and name
+   * hash to a set, and may sit in any of its ways. The ways of a set are
+   * kept roughly in most recently used order: a new entry goes in the
+   * first way, a hit moves its entry one way forward, and when a set is
+   * full the entry in its last way is evicted. The number of entries
+   * can be changed with resize(), which the VM does at boot from the
+   * rbx.cache.size config variable.
+   *
+   * Entries are hashed on Module::id() rather than the address of the
+   * class, so an entry stays where it is when the GC moves the class.
+   * A young collection calls forward_entries() to point the entries at
+   * the new copies of anything that moved, so only method table changes
+   * and mature collections have to throw entries away.
+   *
+   * Method table changes don't touch the entries at all. Every method
+   * name has a serial, which invalidate() bumps. An entry (or a SendSite)
+   * remembers the serial of the name it was filled in for, and is stale
+   * once that has moved on.
+   *
+   * A lookup that found nothing is cached too, as a method_missing entry
+   * holding the method_missing that the send ends up calling. Such an
+   * entry also remembers the serial of method_missing, so defining either
+   * name does away with it.
+   *
+   * The constant caches of push_const and find_const are checked against
+   * constant_serial, which invalidate_constants() bumps whenever a
+   * constant is set or removed, or a module is included. */
   class GlobalCache {
   public:
     struct cache_entry {
@@ -18,69 +52,207 @@ namespace rubinius {
       Symbol* name;
       Module* module;
       Executable* method;
+      uint32_t serial;
+      uint32_t missing_serial;
       bool is_public;
       bool method_missing;
     };
 
-    struct cache_entry entries[CPU_CACHE_SIZE];
+    struct cache_entry* entries;
+    size_t size;
+    size_t mask;
+
+    // Indexed by Symbol index, grown as names are invalidated.
+    std::vector<uint32_t> serials;
+
+    // Set when the first method_missing entry is retained.
+    Symbol* missing_name;
 
-    GlobalCache() {
+    // Starts at 1, so that a zeroed constant cache is never current.
+    uint32_t constant_serial;
+
+    /* Statistics */
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+
+    GlobalCache(size_t entry_count = CPU_CACHE_SIZE)
+      : entries(NULL), size(0), mask(0), missing_name(NULL), constant_serial(1)
+      , hits(0), misses(0), evictions(0)
+    {
+      resize(entry_count);
+    }
+
+    ~GlobalCache() {
+      delete[] entries;
+    }
+
+    /* Use +entry_count+ entries, rounded down to a power of two and
+     * at least one set. Everything cached so far is dropped. */
+    void resize(size_t entry_count) {
+      size_t sets = 1;
+      while(sets * 2 * CPU_CACHE_WAYS <= entry_count) sets *= 2;
+
+      delete[] entries;
+      size = sets * CPU_CACHE_WAYS;
+      mask = sets - 1;
+      entries = new cache_entry[size];
       clear();
     }
 
+    uint32_t serial(Symbol* name) {
+      size_t idx = DATA_STRIP_TAG(name);
+      if(idx >= serials.size()) return 0;
+      return serials[idx];
+    }
+
+    /* Invalidate every cached lookup of +name+, here and in the
+     * SendSites. */
+    void invalidate(Symbol* name) {
+      size_t idx = DATA_STRIP_TAG(name);
+      if(idx >= serials.size()) serials.resize(idx + 1024, 0);
+      serials[idx]++;
+    }
+
+    bool stale_p(struct cache_entry* entry) {
+      if(entry->serial != serial(entry->name)) return true;
+      return entry->method_missing &&
+             entry->missing_serial != serial(missing_name);
+    }
+
+    /* The first way of the set that +id+ and +name+ hash to. */
+    struct cache_entry* set_for(native_int id, Symbol* name) {
+      return entries + (CPU_CACHE_HASH(id, name) & mask) * CPU_CACHE_WAYS;
+    }
+
+    /* Invalidate every cached constant lookup. */
+    void invalidate_constants() {
+      constant_serial++;
+    }
+
     struct cache_entry* lookup(Module* cls, Symbol* name) {
-      struct cache_entry* entry;
+      // Without an id, nothing has been cached for +cls+.
+      if(cls->class_id()->nil_p()) {
+        misses++;
+        return NULL;
+      }
 
-      entry = entries + CPU_CACHE_HASH(cls, name);
-      if(entry->name == name && entry->klass == cls) {
-        return entry;
+      struct cache_entry* set = set_for(cls->class_id()->to_native(), name);
+
+      for(size_t i = 0; i < CPU_CACHE_WAYS; i++) {
+        struct cache_entry* entry = set + i;
+        if(entry->name != name || entry->klass != cls) continue;
+
+        if(stale_p(entry)) break;
+
+        hits++;
+        if(i == 0) return entry;
+
+        // Move it a way closer to the front of the set.
+        struct cache_entry tmp = set[i - 1];
+        set[i - 1] = *entry;
+        *entry = tmp;
+        return set + i - 1;
       }
 
+      misses++;
       return NULL;
     }
 
+    static void clear_entry(struct cache_entry* entry) {
+      entry->klass = 0;
+      entry->name  = 0;
+      entry->module = 0;
+      entry->method = 0;
+      entry->serial = 0;
+      entry->missing_serial = 0;
+      entry->is_public = true;
+      entry->method_missing = false;
+    }
+
     void clear() {
-      for(size_t i = 0; i < CPU_CACHE_SIZE; i++) {
-        entries[i].klass = 0;
-        entries[i].name  = 0;
-        entries[i].module = 0;
-        entries[i].method = 0;
-        entries[i].is_public = true;
-        entries[i].method_missing = false;
+      for(size_t i = 0; i < size; i++) {
+        clear_entry(entries + i);
       }
     }
 
-    void clear(Symbol* name) {
-      for(size_t i = 0; i < CPU_CACHE_SIZE; i++) {
-        if(entries[i].name == name) {
-          entries[i].klass = NULL;
-          entries[i].name = NULL;
-          entries[i].module = NULL;
-          entries[i].method = NULL;
-          entries[i].method_missing = false;
+    /* Called straight after a young collection, while the objects it
+     * copied still have their forwarding pointers. An entry that refers
+     * to a young object that wasn't copied refers to garbage, and is
+     * dropped. */
+    void forward_entries() {
+      for(size_t i = 0; i < size; i++) {
+        struct cache_entry* entry = entries + i;
+        if(!entry->klass) continue;
+
+        if(!forward((Object**)&entry->klass) ||
+           !forward((Object**)&entry->module) ||
+           !forward((Object**)&entry->method)) {
+          clear_entry(entry);
         }
       }
     }
 
-    void clear(Module* cls, Symbol* name) {
-      struct cache_entry* entry;
+    static bool forward(Object** slot) {
+      Object* obj = *slot;
+
+      // NULL passes reference_p(), since TAG_REF is 0.
+      if(!obj) return true;
+      if(!obj->reference_p() || !obj->young_object_p()) return true;
+      if(!obj->forwarded_p()) return false;
+
+      *slot = obj->forward();
+      return true;
+    }
 
-      entry = entries + CPU_CACHE_HASH(cls, name);
-      if(entry->name == name && entry->klass == cls) {
-        entry->klass = NULL;
-        entry->name = NULL;
-        entry->module = NULL;
-        entry->method = NULL;
-        entry->method_missing = false;
+    /* Make room for +cls+ and +name+ in the first way of +set+. The way
+     * given up is an existing entry for them, then a free or stale way,
+     * and failing those the last way, which is evicted. The ways in front
+     * of it move back one. */
+    struct cache_entry* make_room(struct cache_entry* set, Module* cls, Symbol* name) {
+      size_t way = CPU_CACHE_WAYS;
+
+      for(size_t i = 0; i < CPU_CACHE_WAYS; i++) {
+        if(set[i].klass == cls && set[i].name == name) {
+          way = i;
+          break;
+        }
+      }
+
+      if(way == CPU_CACHE_WAYS) {
+        for(size_t i = 0; i < CPU_CACHE_WAYS; i++) {
+          if(!set[i].klass || stale_p(set + i)) {
+            way = i;
+            break;
+          }
+        }
       }
+
+      if(way == CPU_CACHE_WAYS) {
+        way = CPU_CACHE_WAYS - 1;
+        evictions++;
+      }
+
+      for(; way > 0; way--) {
+        set[way] = set[way - 1];
+      }
+
+      return set;
     }
 
+    /* Cache +meth+, found in +mod+, for sends of +name+ to instances of
+     * +cls+. With +missing+ set, +name+ wasn't found and +meth+ is the
+     * method_missing to call instead. */
     void retain(STATE, Module* cls, Symbol* name, Module* mod, Executable* meth, bool missing) {
       struct cache_entry* entry;
 
-      entry = entries + CPU_CACHE_HASH(cls, name);
+      if(missing) missing_name = G(sym_method_missing);
+
+      entry = make_room(set_for(cls->id(state), name), cls, name);
       entry->klass = cls;
       entry->name = name;
+      entry->serial = serial(name);
+      entry->missing_serial = missing ? serial(missing_name) : 0;
       entry->module = mod;
       entry->method_missing = missing;
 
@@ -20,6 +20,21 @@ namespace rubinius {
     scan = start;
   }
 
+  /* Swap the memory for a fresh block of +bytes+. Only for an empty
+   * Heap, since nothing in it is moved. If the new block can't be had,
+   * the old one is kept, so size is left as it was. */
+  void Heap::resize(size_t bytes) {
+    address block = (address)std::calloc(1, bytes);
+    if(!block) return;
+
+    std::free(start);
+
+    size = bytes;
+    start = block;
+    last = (void*)((uintptr_t)start + bytes - 1);
+    reset();
+  }
+
   size_t Heap::remaining() {
     size_t bytes = (uintptr_t)last - (uintptr_t)current;
     return bytes;
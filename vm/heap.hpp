@@ -68,6 +68,7 @@ namespace rubinius {
     Heap(size_t size);
     ~Heap();
     void reset();
+    void resize(size_t bytes);
     size_t remaining();
     size_t used();
     Object* copy_object(Object*);
@@ -530,13 +530,17 @@ class Instructions
   # [Description]
   #   Takes a +compiled_method+ out of the literals tuple, and converts it
   #   into a block environment +block_env+, which is then pushed back onto the
-  #   stack.
+  #   stack. As the block captures the current context, it is first moved off
+  #   the context stack into the heap, along with any callers that have not
+  #   escaped yet.
 
   def create_block(index)
     <<-CODE
     Object* _lit = task->literals()->at(state, index);
     CompiledMethod* cm = as<CompiledMethod>(_lit);
 
+    promote_active();
+
     MethodContext* parent;
     if(kind_of<BlockContext>(task->active())) {
       parent = as<BlockContext>(task->active())->env()->home();
@@ -663,8 +667,15 @@ class Instructions
     <<-CODE
     bool found;
     Module* under = as<Module>(stack_pop());
+    Object* res = vmm->cached_constant(index, under,
+                                       state->global_cache->constant_serial);
+    if(likely(res)) {
+      stack_push(res);
+      RETURN(false);
+    }
+
     Symbol* sym = as<Symbol>(task->literals()->at(state, index));
-    Object* res = task->const_get(under, sym, &found);
+    res = task->const_get(under, sym, &found);
     if(!found) {
       Message& msg = *task->msg;
       msg.recv = under;
@@ -680,6 +691,7 @@ class Instructions
       RETURN(res);
     }
 
+    vmm->cache_constant(state, index, under, res);
     stack_push(res);
     RETURN(false);
     CODE
@@ -698,6 +710,20 @@ class Instructions
     run();
 
     TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(3));
+
+    Class* cls = state->new_class("Blah");
+    cls->set_const(state, name, Fixnum::from(4));
+    task->push(cls);
+    run();
+
+    TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(4));
+
+    state->global_cache->invalidate_constants();
+    G(true_class)->constants()->store(state, name, Fixnum::from(5));
+    task->push(G(true_class));
+    run();
+
+    TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(5));
     CODE
   end
 
@@ -892,6 +918,237 @@ class Instructions
     CODE
   end
 
+  # [Operation]
+  #   Runs the inlined target of a send with no arguments
+  # [Format]
+  #   \inline_send_method method_name
+  # [Stack Before]
+  #   * receiver
+  #   * ...
+  # [Stack After]
+  #   * retval
+  #   * ...
+  # [Description]
+  #   Replaces a send_method whose target is a reader (see
+  #   VMMethod::inline_body) once the send has settled on it. The body of
+  #   the target is run in place, with no MethodContext.
+  #
+  #   If +receiver+ is not of the class the target was inlined for, or a
+  #   method named +method_name+ has been added or removed since, the
+  #   inlined body is dropped and this does a full send_method.
+  # [Notes]
+  #   Never emitted by the compiler, the VM rewrites sends into this.
+
+  def inline_send_method(index)
+    <<-CODE
+    if(Object* ret = vmm->run_inline(state, index, stack_top(), Qnil)) {
+      task->call_flags = 0;
+      stack_set_top(ret);
+      RETURN(cExecuteContinue);
+    }
+
+    // The send may have settled on a new target.
+    vmm->inline_send(state, index, 0, ctx->ip - 2,
+                     InstructionSequence::insn_inline_send_method);
+
+    Message& msg = *task->msg;
+
+    msg.setup(
+      vmm->sendsites[index].get(),
+      stack_top(),
+      ctx,
+      0,
+      1);
+
+    msg.block = Qnil;
+    msg.splat = Qnil;
+
+    msg.priv = task->call_flags & #{CALL_FLAG_PRIVATE};
+    msg.lookup_from = msg.recv->lookup_begin(state);
+    msg.name = msg.send_site->name();
+
+    task->call_flags = 0;
+
+    RETURN(msg.send_site->performer(state, task, msg));
+    CODE
+  end
+
+  def test_inline_send_method
+    <<-CODE
+    CompiledMethod* target = CompiledMethod::create(state);
+    target->iseq(state, InstructionSequence::create(state, 3));
+    target->iseq()->opcodes()->put(state, 0, Fixnum::from(InstructionSequence::insn_push_int));
+    target->iseq()->opcodes()->put(state, 1, Fixnum::from(42));
+    target->iseq()->opcodes()->put(state, 2, Fixnum::from(InstructionSequence::insn_ret));
+    target->total_args(state, Fixnum::from(0));
+    target->required_args(state, target->total_args());
+    target->stack_size(state, Fixnum::from(1));
+    target->formalize(state);
+
+    Symbol* name = state->symbol("blah");
+    G(true_class)->method_table()->store(state, name, target);
+    SendSite* ss = SendSite::create(state, name);
+    ss->recv_class(state, G(true_class));
+    ss->method(state, target);
+    ss->module(state, G(true_class));
+    ss->performer = performer::mono_performer;
+    ss->name_serial = state->global_cache->serial(name);
+
+    TypedRoot<SendSite*> tr_ss(state, ss);
+    ctx->vmm->sendsites = &tr_ss;
+    ctx->vmm->literal_count = 1;
+    ctx->vmm->opcodes[0] = InstructionSequence::insn_send_method;
+    ctx->vmm->opcodes[1] = 0;
+
+    // The body of a primitive is only its fallback.
+    target->primitive(state, state->symbol("float_neg"));
+    TS_ASSERT(!ctx->vmm->inline_send(state, 0, 0, 0,
+              InstructionSequence::insn_inline_send_method));
+    TS_ASSERT_EQUALS((opcode)InstructionSequence::insn_send_method,
+                     ctx->vmm->opcodes[0]);
+    target->primitive(state, (Symbol*)Qnil);
+
+    TS_ASSERT(ctx->vmm->inline_send(state, 0, 0, 0,
+              InstructionSequence::insn_inline_send_method));
+    TS_ASSERT_EQUALS((opcode)InstructionSequence::insn_inline_send_method,
+                     ctx->vmm->opcodes[0]);
+
+    task->literals()->put(state, 0, ss);
+    task->push(Qtrue);
+
+    stream[1] = (opcode)0;
+
+    run();
+
+    TS_ASSERT_EQUALS(task->active(), ctx);
+    TS_ASSERT_EQUALS(Fixnum::from(42), task->stack_top());
+
+    // A new method of the name, so the send is a real one again.
+    G(true_class)->method_table()->store(state, name, target);
+    task->push(Qtrue);
+
+    run();
+
+    TS_ASSERT_EQUALS(task->active()->cm(), target);
+    TS_ASSERT_EQUALS(1U, ctx->vmm->inlines[0].deopts);
+    CODE
+  end
+
+  # [Operation]
+  #   Runs the inlined target of a send with arguments on the stack
+  # [Format]
+  #   \inline_send_stack method argc
+  # [Stack Before]
+  #   * arg1
+  #   * receiver
+  #   * ...
+  # [Stack After]
+  #   * retval
+  #   * ...
+  # [Description]
+  #   Replaces a send_stack whose target is a writer (see
+  #   VMMethod::inline_body) once the send has settled on it. The body of
+  #   the target is run in place, with no MethodContext.
+  #
+  #   If +receiver+ is not of the class the target was inlined for, or a
+  #   method named +method+ has been added or removed since, the inlined
+  #   body is dropped and this does a full send_stack.
+  # [Notes]
+  #   Never emitted by the compiler, the VM rewrites sends into this.
+
+  def inline_send_stack(index, count)
+    <<-CODE
+    if(count == 1) {
+      Object* arg = stack_top();
+      if(Object* ret = vmm->run_inline(state, index, stack_back(1), arg)) {
+        task->call_flags = 0;
+        stack_pop();
+        stack_set_top(ret);
+        RETURN(cExecuteContinue);
+      }
+    }
+
+    // The send may have settled on a new target.
+    vmm->inline_send(state, index, count, ctx->ip - 3,
+                     InstructionSequence::insn_inline_send_stack);
+
+    Message& msg = *task->msg;
+
+    msg.setup(
+      vmm->sendsites[index].get(),
+      stack_back(count),
+      ctx,
+      count,
+      count + 1);
+
+    msg.block = Qnil;
+    msg.splat = Qnil;
+
+    msg.priv = task->call_flags & #{CALL_FLAG_PRIVATE};
+    msg.lookup_from = msg.recv->lookup_begin(state);
+    msg.name = msg.send_site->name();
+
+    task->call_flags = 0;
+
+    RETURN(msg.send_site->performer(state, task, msg));
+    CODE
+  end
+
+  def test_inline_send_stack
+    <<-CODE
+    Symbol* ivar = state->symbol("@blah");
+    CompiledMethod* target = CompiledMethod::create(state);
+    target->iseq(state, InstructionSequence::create(state, 5));
+    target->iseq()->opcodes()->put(state, 0, Fixnum::from(InstructionSequence::insn_push_local));
+    target->iseq()->opcodes()->put(state, 1, Fixnum::from(0));
+    target->iseq()->opcodes()->put(state, 2, Fixnum::from(InstructionSequence::insn_set_ivar));
+    target->iseq()->opcodes()->put(state, 3, Fixnum::from(0));
+    target->iseq()->opcodes()->put(state, 4, Fixnum::from(InstructionSequence::insn_ret));
+    target->literals(state, Tuple::from(state, 1, ivar));
+    target->total_args(state, Fixnum::from(1));
+    target->required_args(state, target->total_args());
+    target->stack_size(state, Fixnum::from(1));
+    target->formalize(state);
+
+    Class* cls = state->new_class("InlineTest");
+    Object* obj = state->new_object(cls);
+
+    Symbol* name = state->symbol("blah=");
+    SendSite* ss = SendSite::create(state, name);
+    ss->recv_class(state, cls);
+    ss->method(state, target);
+    ss->module(state, cls);
+    ss->performer = performer::mono_performer;
+    ss->name_serial = state->global_cache->serial(name);
+
+    TypedRoot<SendSite*> tr_ss(state, ss);
+    ctx->vmm->sendsites = &tr_ss;
+    ctx->vmm->literal_count = 1;
+    ctx->vmm->opcodes[0] = InstructionSequence::insn_send_stack;
+    ctx->vmm->opcodes[1] = 0;
+    ctx->vmm->opcodes[2] = 1;
+
+    TS_ASSERT(!ctx->vmm->inline_send(state, 0, 0, 0,
+              InstructionSequence::insn_inline_send_stack));
+    TS_ASSERT(ctx->vmm->inline_send(state, 0, 1, 0,
+              InstructionSequence::insn_inline_send_stack));
+
+    task->literals()->put(state, 0, ss);
+    task->push(obj);
+    task->push(Fixnum::from(3));
+
+    stream[1] = (opcode)0;
+    stream[2] = (opcode)1;
+
+    run();
+
+    TS_ASSERT_EQUALS(task->active(), ctx);
+    TS_ASSERT_EQUALS(task->calculate_sp(), 0);
+    TS_ASSERT_EQUALS(Fixnum::from(3), task->stack_top());
+    TS_ASSERT_EQUALS(Fixnum::from(3), obj->get_ivar(state, ivar));
+    CODE
+  end
+
   # [Operation]
   #   Evaluate if +object+ is an instance of +class+
   # [Format]
@@ -1465,6 +1722,7 @@ class Instructions
       RETURN(false);
     }
 
+    vmm->profile_floats(ctx->ip - 1, t1, t2);
     RETURN(send_slowly(vmm, task, ctx, G(sym_gt), 1));
     CODE
   end
@@ -1513,6 +1771,7 @@ class Instructions
       RETURN(false);
     }
 
+    vmm->profile_floats(ctx->ip - 1, t1, t2);
     RETURN(send_slowly(vmm, task, ctx, G(sym_lt), 1));
     CODE
   end
@@ -1562,6 +1821,7 @@ class Instructions
       RETURN(false);
     }
 
+    vmm->profile_floats(ctx->ip - 1, left, right);
     RETURN(send_slowly(vmm, task, ctx, G(sym_minus), 1));
     CODE
   end
@@ -1661,6 +1921,7 @@ class Instructions
       RETURN(false);
     }
 
+    vmm->profile_floats(ctx->ip - 1, left, right);
     RETURN(send_slowly(vmm, task, ctx, G(sym_plus), 1));
     CODE
   end
@@ -2223,11 +2484,18 @@ class Instructions
   def push_const(index)
     <<-CODE
     bool found;
+    StaticScope* scope = task->active()->cm()->scope();
+    Object* res = vmm->cached_constant(index, scope,
+                                       state->global_cache->constant_serial);
+    if(likely(res)) {
+      stack_push(res);
+      RETURN(false);
+    }
+
     Symbol* sym = as<Symbol>(task->literals()->at(state, index));
-    Object* res = task->const_get(sym, &found);
+    res = task->const_get(sym, &found);
     if(!found) {
       Message& msg = *task->msg;
-      StaticScope* scope = task->active()->cm()->scope();
       if(scope->nil_p()) {
         msg.recv = G(object);
       } else {
@@ -2245,6 +2513,7 @@ class Instructions
       RETURN(res);
     }
 
+    vmm->cache_constant(state, index, scope, res);
     stack_push(res);
     RETURN(false);
     CODE
@@ -2275,6 +2544,15 @@ class Instructions
 
     TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(3));
 
+    // Cached now, so a change behind the VM's back isn't seen...
+    parent->constants()->store(state, name, Fixnum::from(4));
+    run();
+    TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(3));
+
+    // ...until a constant is set.
+    parent->set_const(state, name, Fixnum::from(5));
+    run();
+    TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(5));
     CODE
   end
 
@@ -2289,10 +2567,12 @@ class Instructions
   #   * ...
   # [Description]
   #   Creates a reference to the current method execution context, and pushes
-  #   it onto the stack.
+  #   it onto the stack. The context, and any of its callers that have not
+  #   escaped yet, are first moved off the context stack into the heap.
 
   def push_context
     <<-CODE
+    promote_active();
     ctx->reference(state);
     stack_push(ctx);
     CODE
@@ -2452,8 +2732,15 @@ class Instructions
 
   def push_ivar(index)
     <<-CODE
-    Symbol* sym = as<Symbol>(task->literals()->at(state, index));
-    stack_push(task->self()->get_ivar(state, sym));
+    Object* self = task->self();
+
+    if(Tuple* ivars = vmm->cached_ivars(index, self)) {
+      stack_push(ivars->field[vmm->ivar_caches[index].field]);
+    } else {
+      Symbol* sym = as<Symbol>(task->literals()->at(state, index));
+      stack_push(self->get_ivar(state, sym));
+      vmm->cache_ivar(state, index, self, sym);
+    }
     CODE
   end
 
@@ -2469,6 +2756,33 @@ class Instructions
 
     TS_ASSERT_EQUALS(task->calculate_sp(), 0);
     TS_ASSERT_EQUALS(task->stack_top(), Qtrue);
+
+    Symbol* other = state->symbol("@other");
+    Object* obj = state->new_object(G(object));
+    obj->set_ivar(state, other, Qfalse);
+    obj->set_ivar(state, name, Fixnum::from(1));
+    task->self(state, obj);
+    run();
+
+    TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(1));
+    TS_ASSERT(ctx->vmm->ivar_caches);
+
+    // An object of the same Shape is read from the cached field...
+    Object* same = state->new_object(G(object));
+    same->set_ivar(state, other, Qfalse);
+    same->set_ivar(state, name, Fixnum::from(2));
+    task->self(state, same);
+    run();
+
+    TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(2));
+
+    // ...and one of another Shape is looked up again.
+    Object* diff = state->new_object(G(object));
+    diff->set_ivar(state, name, Fixnum::from(3));
+    task->self(state, diff);
+    run();
+
+    TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(3));
     CODE
   end
 
@@ -2928,6 +3242,11 @@ class Instructions
 
     task->call_flags = 0;
 
+    if(unlikely(msg.send_site->hits == state->config.inline_threshold)) {
+      vmm->inline_send(state, index, 0, ctx->ip - 2,
+                       InstructionSequence::insn_inline_send_method);
+    }
+
     RETURN(msg.send_site->performer(state, task, msg));
     CODE
   end
@@ -3010,6 +3329,11 @@ class Instructions
 
     task->call_flags = 0;
 
+    if(unlikely(msg.send_site->hits == state->config.inline_threshold)) {
+      vmm->inline_send(state, index, count, ctx->ip - 3,
+                       InstructionSequence::insn_inline_send_stack);
+    }
+
     RETURN(msg.send_site->performer(state, task, msg));
     CODE
   end
@@ -3347,7 +3671,7 @@ class Instructions
 
     // Now test that send finds a private method
 
-    state->global_cache->clear(child, blah);
+    state->global_cache->invalidate(blah);
     task = Task::create(state);
 
     ctx = MethodContext::create(state, Qnil, cm);
@@ -3629,8 +3953,15 @@ class Instructions
 
   def set_ivar(index)
     <<-CODE
-    Symbol* sym = as<Symbol>(task->literals()->at(state, index));
-    task->self()->set_ivar(state, sym, stack_top());
+    Object* self = task->self();
+
+    if(Tuple* ivars = vmm->cached_ivars(index, self)) {
+      ivars->put(state, vmm->ivar_caches[index].field, stack_top());
+    } else {
+      Symbol* sym = as<Symbol>(task->literals()->at(state, index));
+      self->set_ivar(state, sym, stack_top());
+      vmm->cache_ivar(state, index, self, sym);
+    }
     CODE
   end
 
@@ -3647,6 +3978,21 @@ class Instructions
     TS_ASSERT_EQUALS(Qtrue->get_ivar(state, name), Qfalse);
     TS_ASSERT_EQUALS(task->calculate_sp(), 0);
     TS_ASSERT_EQUALS(task->stack_top(), Qfalse);
+
+    Object* obj = state->new_object(G(object));
+    task->self(state, obj);
+    run();
+    run();
+
+    TS_ASSERT(ctx->vmm->ivar_caches);
+    TS_ASSERT_EQUALS(obj->get_ivar(state, name), Qfalse);
+
+    Object* same = state->new_object(G(object));
+    same->set_ivar(state, name, Qnil);
+    task->self(state, same);
+    run();
+
+    TS_ASSERT_EQUALS(same->get_ivar(state, name), Qfalse);
     CODE
   end
 
@@ -48,6 +48,7 @@
 #include <llvm/Analysis/Verifier.h>
 
 #include <algorithm>
+#include <csignal>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -61,6 +62,9 @@ namespace rubinius {
   static llvm::ExistingModuleProvider* mp = NULL;
   static llvm::ExecutionEngine* engine = NULL;
 
+  /* Guards the statics above, see JITCompiler. */
+  static pthread_mutex_t llvm_lock = PTHREAD_MUTEX_INITIALIZER;
+
   // static llvm::Function* puts = NULL;
 
   llvm::Module* VM::llvm_module() {
@@ -131,6 +135,109 @@ namespace rubinius {
     return CallInst::Create(func, args.begin(), args.end(), "", block);
   }
 
+  /* Emit the fast paths of a meta_send_op_plus, _minus, _lt or _gt into
+   * +cur+: the arithmetic on two tagged Fixnums, with a sum or difference
+   * that leaves the Fixnum range going the slow way to become a Bignum,
+   * and, if +floats+, the jit_float_op_* for two Floats. Each path guards
+   * on the operands' types and goes on at +stay+ when it's done. Returns
+   * the block to emit the generic operation into, where a failed guard
+   * goes. */
+  static BasicBlock* emit_arithmetic(Opcode* op, Value* task, Value* js,
+      BasicBlock* cur, BasicBlock* stay, bool floats,
+      std::vector<CallInst*>& calls) {
+    Function* func = cur->getParent();
+    const Type* word = IntegerType::get(sizeof(native_int) * 8);
+
+    Value* zero = ConstantInt::get(Type::Int32Ty, 0);
+    Value* sp_index[] = { zero, zero };
+    Value* sp = GetElementPtrInst::Create(js, sp_index, sp_index + 2, "sp", cur);
+    Value* stack = new LoadInst(sp, "stack", cur);
+    Value* left_slot = GetElementPtrInst::Create(stack,
+        ConstantInt::get(Type::Int32Ty, (uint64_t)-1, true), "left_slot", cur);
+
+    const Type* obj_type = cast<PointerType>(stack->getType())->getElementType();
+    Value* left = new PtrToIntInst(new LoadInst(left_slot, "left", cur),
+        word, "left_word", cur);
+    Value* right = new PtrToIntInst(new LoadInst(stack, "right", cur),
+        word, "right_word", cur);
+
+    Value* mask = ConstantInt::get(word, TAG_MASK);
+    Value* tag = ConstantInt::get(word, TAG_FIXNUM);
+    Value* shift = ConstantInt::get(word, TAG_SHIFT);
+
+    Value* left_fix = new ICmpInst(ICmpInst::ICMP_EQ,
+        BinaryOperator::CreateAnd(left, mask, "left_tag", cur), tag, "left_fix", cur);
+    Value* right_fix = new ICmpInst(ICmpInst::ICMP_EQ,
+        BinaryOperator::CreateAnd(right, mask, "right_tag", cur), tag, "right_fix", cur);
+    Value* both_fix = BinaryOperator::CreateAnd(left_fix, right_fix, "both_fix", cur);
+
+    BasicBlock* slow = BasicBlock::Create("slow", func);
+    BasicBlock* other = floats ? BasicBlock::Create("float", func) : slow;
+    BasicBlock* fix = BasicBlock::Create("fixnum", func);
+    BranchInst::Create(fix, other, both_fix, cur);
+
+    Value* l = BinaryOperator::CreateAShr(left, shift, "l", fix);
+    Value* r = BinaryOperator::CreateAShr(right, shift, "r", fix);
+    Value* result = NULL;
+
+    switch(op->op) {
+    case InstructionSequence::insn_meta_send_op_plus:
+    case InstructionSequence::insn_meta_send_op_minus: {
+      /* Both fit in FIXNUM_WIDTH bits, so this can't wrap the word. */
+      Value* n = op->op == InstructionSequence::insn_meta_send_op_plus ?
+        BinaryOperator::CreateAdd(l, r, "n", fix) :
+        BinaryOperator::CreateSub(l, r, "n", fix);
+
+      Value* below_max = new ICmpInst(ICmpInst::ICMP_SLE, n,
+          ConstantInt::get(word, FIXNUM_MAX, true), "below_max", fix);
+      Value* above_min = new ICmpInst(ICmpInst::ICMP_SGE, n,
+          ConstantInt::get(word, FIXNUM_MIN, true), "above_min", fix);
+      Value* in_range = BinaryOperator::CreateAnd(below_max, above_min, "in_range", fix);
+
+      BasicBlock* box = BasicBlock::Create("fixnum_result", func);
+      BranchInst::Create(box, slow, in_range, fix);
+      fix = box;
+
+      result = BinaryOperator::CreateOr(
+          BinaryOperator::CreateShl(n, shift, "shifted", fix), tag, "tagged", fix);
+      break;
+    }
+    case InstructionSequence::insn_meta_send_op_lt:
+    case InstructionSequence::insn_meta_send_op_gt: {
+      Value* cmp = new ICmpInst(
+          op->op == InstructionSequence::insn_meta_send_op_lt ?
+            ICmpInst::ICMP_SLT : ICmpInst::ICMP_SGT,
+          l, r, "cmp", fix);
+      result = SelectInst::Create(cmp,
+          ConstantInt::get(word, (intptr_t)Qtrue),
+          ConstantInt::get(word, (intptr_t)Qfalse), "bool", fix);
+      break;
+    }
+    default:
+      abort();
+    }
+
+    /* Pop the operands and push the result. */
+    new StoreInst(new IntToPtrInst(result, obj_type, "result", fix), left_slot, fix);
+    new StoreInst(left_slot, sp, fix);
+    BranchInst::Create(stay, fix);
+
+    if(floats) {
+      std::string name("jit_float_");
+      name += InstructionSequence::get_instruction_name(op->op) + strlen("meta_send_");
+
+      CallInst* call = call_function(name, task, js, other);
+      call->setName("float_done");
+      calls.push_back(call);
+
+      ICmpInst* done = new ICmpInst(ICmpInst::ICMP_EQ, call,
+          ConstantInt::get(Type::Int8Ty, 1), "cmp", other);
+      BranchInst::Create(stay, slow, done, other);
+    }
+
+    return slow;
+  }
+
   CallInst* VMLLVMMethod::call_operation(Opcode* op, Value* task,
                                          Value* js, BasicBlock* block) {
     const char* name = InstructionSequence::get_instruction_name(op->op);
@@ -287,8 +394,21 @@ namespace rubinius {
   }
 
   void VMLLVMMethod::compile(STATE) {
-    const char* name = original->name()->c_str(state);
-    Function* func = create_function(name);
+    std::string name(original->name()->c_str(state));
+
+    pthread_mutex_lock(&llvm_lock);
+    try {
+      generate(name);
+    } catch(...) {
+      pthread_mutex_unlock(&llvm_lock);
+      throw;
+    }
+    pthread_mutex_unlock(&llvm_lock);
+  }
+
+  /* Must be called holding llvm_lock. */
+  void VMLLVMMethod::generate(const std::string& name) {
+    Function* func = create_function(name.c_str());
 
     Function::arg_iterator args = func->arg_begin();
     Value* task = args++;
@@ -369,6 +489,14 @@ namespace rubinius {
         cur = bb;
         break;
       }
+      case InstructionSequence::insn_meta_send_op_plus:
+      case InstructionSequence::insn_meta_send_op_minus:
+      case InstructionSequence::insn_meta_send_op_lt:
+      case InstructionSequence::insn_meta_send_op_gt:
+        cur = emit_arithmetic(op, task, js, cur, blocks[cur_block + 1],
+            float_sites.count(op->ip) > 0, calls);
+        call = call_operation(op, task, js, cur);
+        break;
       case InstructionSequence::insn_halt:
         new StoreInst(ConstantInt::get(Type::Int32Ty, (uint64_t)-1), next_pos, cur);
         break;
@@ -465,6 +593,122 @@ namespace rubinius {
       throw Task::Halt("Task halted");
     }
   }
+
+  JITCompiler::JITCompiler() :
+      compiler_running(false), compiler_exit(false), background(true) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cond, NULL);
+  }
+
+  JITCompiler::~JITCompiler() {
+    stop_compiler();
+
+    /* Never compiled, so nothing has seen these yet. */
+    for(std::list<Request>::iterator i = requests.begin(); i != requests.end(); i++) {
+      delete i->llvm;
+    }
+
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+  }
+
+  void JITCompiler::add(STATE, CompiledMethod* cm, VMMethod* vmm) {
+    Request req;
+    req.vmm = vmm;
+
+    // Building the backend resets the executor; keep whatever cm had.
+    executor exec = cm->execute;
+    req.llvm = new VMLLVMMethod(state, cm);
+    cm->set_executor(exec);
+
+    req.name = std::string(cm->name()->c_str(state));
+
+    req.llvm->float_sites = vmm->float_sites;
+    if(vmm->type) req.llvm->specialize(state, vmm->type);
+
+    start_compiler();
+
+    if(!background) {
+      compile(req);
+      return;
+    }
+
+    pthread_mutex_lock(&lock);
+    requests.push_back(req);
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+  }
+
+  void JITCompiler::compile(Request& req) {
+    pthread_mutex_lock(&llvm_lock);
+    try {
+      req.llvm->generate(req.name);
+    } catch(std::runtime_error& e) {
+      req.llvm->c_func = NULL;
+    }
+    pthread_mutex_unlock(&llvm_lock);
+
+    // Everything the compiler wrote to req.llvm must be seen before it is.
+    __sync_synchronize();
+    req.vmm->jitted = req.llvm;
+  }
+
+  static void* __compiler_tramp__(void* arg) {
+    // Signals are for the main thread to deal with.
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    static_cast<JITCompiler*>(arg)->compiler_loop();
+    return NULL;
+  }
+
+  void JITCompiler::start_compiler() {
+    if(compiler_running || !background) return;
+
+    compiler_exit = false;
+    if(pthread_create(&compiler, NULL, __compiler_tramp__, this) != 0) {
+      std::cerr << "Unable to create JIT thread, compiling in the foreground\n";
+      background = false;
+      return;
+    }
+
+    compiler_running = true;
+  }
+
+  void JITCompiler::stop_compiler() {
+    if(!compiler_running) return;
+
+    pthread_mutex_lock(&lock);
+    compiler_exit = true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(compiler, NULL);
+    compiler_running = false;
+  }
+
+  /* Compile the queued methods in order, letting go of lock while
+   * compiling so the interpreter can queue more. */
+  void JITCompiler::compiler_loop() {
+    pthread_mutex_lock(&lock);
+
+    while(!compiler_exit) {
+      if(requests.empty()) {
+        pthread_cond_wait(&cond, &lock);
+        continue;
+      }
+
+      Request req = requests.front();
+      requests.pop_front();
+
+      pthread_mutex_unlock(&lock);
+      compile(req);
+      pthread_mutex_lock(&lock);
+    }
+
+    pthread_mutex_unlock(&lock);
+  }
 }
 
 #endif
@@ -7,6 +7,10 @@
 #include <llvm/Module.h>
 #include <llvm/Instructions.h>
 
+#include <pthread.h>
+#include <list>
+#include <string>
+
 struct jit_state;
 namespace rubinius {
   typedef void (*CompiledFunction)(Task*, struct jit_state* const, int*);
@@ -17,15 +21,63 @@ namespace rubinius {
     CompiledFunction c_func;
 
     VMLLVMMethod(STATE, CompiledMethod* meth) :
-      VMMethod(state, meth), function(NULL), c_func(NULL) { }
+      VMMethod(state, meth), function(NULL), c_func(NULL) {
+      jit_requested = true;
+      // Its ctx->ip counts basic blocks, not instructions, so it can't
+      // be started past the block arguments.
+      block_args = cBlockArgsTuple;
+    }
     static void init(const char* path);
     llvm::CallInst* call_operation(Opcode* op, llvm::Value* state,
         llvm::Value*task, llvm::BasicBlock* block);
     virtual void compile(STATE);
+    void generate(const std::string& name);
     virtual void resume(Task* task, MethodContext* ctx);
 
     static ExecuteStatus uncompiled_execute(STATE, Task* task, Message& msg);
   };
+
+  /* Compiles hot methods on a thread of its own, so that the interpreter
+   * doesn't stop while LLVM optimizes and generates code.
+   *
+   * add() makes the VMLLVMMethod on the interpreter's thread, since that
+   * reads the CompiledMethod, and queues it. The compiler thread then only
+   * runs VMLLVMMethod::generate, which uses nothing but the copied opcodes
+   * and LLVM, so it never touches the heap while the GC may be moving it.
+   * When it is done, the compiler publishes the VMLLVMMethod in the jitted
+   * field of the interpreted VMMethod, and the next call to the method
+   * installs it (see VMMethod::count_call). If compiling fails, the
+   * published VMLLVMMethod has no c_func and is thrown away instead.
+   *
+   * All use of LLVM, here or in VMLLVMMethod::compile, is done holding
+   * llvm_lock, as the module and ExecutionEngine are shared. */
+  class JITCompiler {
+  public:
+    struct Request {
+      VMMethod* vmm;
+      VMLLVMMethod* llvm;
+      std::string name;
+    };
+
+    JITCompiler();
+    ~JITCompiler();
+
+    void add(STATE, CompiledMethod* cm, VMMethod* vmm);
+    void compile(Request& req);
+
+    void start_compiler();
+    void stop_compiler();
+    void compiler_loop();
+
+  private:
+    std::list<Request> requests;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_t compiler;
+    bool compiler_running;
+    bool compiler_exit;
+    bool background;
+  };
 }
 
 #endif
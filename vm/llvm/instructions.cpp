@@ -7,6 +7,7 @@
 #include "builtin/compiledmethod.hpp"
 #include "builtin/exception.hpp"
 #include "builtin/fixnum.hpp"
+#include "builtin/float.hpp"
 #include "builtin/sendsite.hpp"
 #include "builtin/string.hpp"
 #include "builtin/symbol.hpp"
@@ -21,6 +22,7 @@
 
 #include "objectmemory.hpp"
 #include "message.hpp"
+#include "global_cache.hpp"
 
 #define USE_JUMP_TABLE
 
@@ -56,6 +58,10 @@ extern "C" {
 
 #define RETURN(val) return val
 
+/* JIT code can't have its context moved out from under it, so leave
+ * the active context where it is. The instruction references it. */
+#define promote_active()
+
 #ruby <<CODE
 require 'stringio'
 require 'vm/instructions.rb'
@@ -114,6 +120,49 @@ CODE
     return val != Qundef;
   }
 
+  /* The Float paths of the arithmetic meta sends, for the JIT. Each one
+   * leaves the stack alone and returns false unless both operands are
+   * Floats. See emit_arithmetic in llvm.cpp. */
+  OP2(bool, jit_float_op_plus) {
+    Float* left = try_as<Float>(stack_back(1));
+    Float* right = try_as<Float>(stack_back(0));
+    if(!left || !right) return false;
+
+    stack_pop();
+    stack_set_top(Float::create(state, left->val + right->val));
+    return true;
+  }
+
+  OP2(bool, jit_float_op_minus) {
+    Float* left = try_as<Float>(stack_back(1));
+    Float* right = try_as<Float>(stack_back(0));
+    if(!left || !right) return false;
+
+    stack_pop();
+    stack_set_top(Float::create(state, left->val - right->val));
+    return true;
+  }
+
+  OP2(bool, jit_float_op_lt) {
+    Float* left = try_as<Float>(stack_back(1));
+    Float* right = try_as<Float>(stack_back(0));
+    if(!left || !right) return false;
+
+    stack_pop();
+    stack_set_top(left->val < right->val ? Qtrue : Qfalse);
+    return true;
+  }
+
+  OP2(bool, jit_float_op_gt) {
+    Float* left = try_as<Float>(stack_back(1));
+    Float* right = try_as<Float>(stack_back(0));
+    if(!left || !right) return false;
+
+    stack_pop();
+    stack_set_top(left->val > right->val ? Qtrue : Qfalse);
+    return true;
+  }
+
   ExecuteStatus send_slowly(VMMethod* vmm, Task* task, MethodContext* const ctx, Symbol* name, size_t args) {
     Message& msg = *task->msg;
     msg.recv = stack_back(args);
@@ -137,6 +186,10 @@ CODE
 #undef RETURN
 #define RETURN(val) (void)val; return;
 
+/* Move the active context into the heap and keep running in the copy. */
+#undef promote_active
+#define promote_active() ctx = task->promote_active()
+
 void rubinius::Task::execute_stream(opcode* stream) {
   opcode op;
   Task* task = this;
@@ -162,14 +215,15 @@ CODE
 
 void VMMethod::resume(Task* task, MethodContext* ctx) {
   VMMethod* const vmm = this;
-  opcode* stream = ctx->vmm->opcodes;
 #ifdef USE_JUMP_TABLE
 
-#undef RETURN
-#define RETURN(val) if((val) == cExecuteRestart) { return; } else { \
-  if(unlikely(state->interrupts.check)) return;\
-  goto *insn_locations[stream[ctx->ip++]]; \
-}
+/* Operands are inline in the threaded form */
+#undef next_int
+#define next_int ((opcode)(uintptr_t)threaded[ctx->ip++])
+
+#define DISPATCH goto *threaded[ctx->ip++]
+#define CHECK_INTERRUPTS if(unlikely(state->interrupts.check)) return
+#define BACKWARD_BRANCH vmm->backedge_count++; CHECK_INTERRUPTS
 
 #ruby <<CODE
 io = StringIO.new
@@ -178,6 +232,7 @@ puts io.string
 CODE
 
 #else
+  opcode* stream = ctx->vmm->opcodes;
   opcode op;
 
 #undef RETURN
@@ -199,3 +254,7 @@ CODE
   }
 #endif // USE_JUMP_TABLE
 }
+
+#ruby <<CODE
+puts si.generate_superinstruction_finder(impl)
+CODE
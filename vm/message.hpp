@@ -148,6 +148,13 @@ namespace rubinius {
       return arguments_[index];
     }
 
+    /*
+     * The arguments, in order
+     */
+    Object** arguments() {
+      return arguments_;
+    }
+
     /*
      * Clear the caller's stack
      */
@@ -4,6 +4,8 @@
 #include "vm.hpp"
 #include "objectmemory.hpp"
 #include "gc_marksweep.hpp"
+#include "gc_compact.hpp"
+#include "vm/object_utils.hpp"
 #include "builtin/class.hpp"
 #include "builtin/fixnum.hpp"
 #include "builtin/tuple.hpp"
@@ -18,12 +20,16 @@ namespace rubinius {
       contexts(cContextHeapSize) {
 
     remember_set = new ObjectArray(0);
+    card_set = new ObjectArray(0);
 
     collect_young_now = false;
     collect_mature_now = false;
+    compact_pending = false;
     large_object_threshold = 2700;
+    pretenure = false;
     young.lifetime = 6;
     last_object_id = 0;
+    last_class_id = 0;
 
     for(size_t i = 0; i < LastObjectType; i++) {
       type_info[i] = NULL;
@@ -40,6 +46,7 @@ namespace rubinius {
     mature.free_objects();
 
     delete remember_set;
+    delete card_set;
 
     for(size_t i = 0; i < LastObjectType; i++) {
       if(type_info[i]) delete type_info[i];
@@ -52,9 +59,9 @@ namespace rubinius {
 
   void ObjectMemory::debug_marksweep(bool val) {
     if(val) {
-      mature.free_entries = false;
+      mature.release_pages = false;
     } else {
-      mature.free_entries = true;
+      mature.release_pages = true;
     }
   }
 
@@ -71,9 +78,7 @@ namespace rubinius {
   /* Garbage collection */
 
   Object* ObjectMemory::promote_object(Object* obj) {
-    Object* copy = mature.copy_object(obj);
-    copy->zone = MatureObjectZone;
-    return copy;
+    return mature.copy_object(obj);
   }
 
   void ObjectMemory::collect_young(Roots &roots) {
@@ -82,10 +87,33 @@ namespace rubinius {
     collect_times++;
 
     contexts.reset();
+
+    // Every object left in the young generation is now live, so a
+    // compaction held back until the sweep was done can run without the
+    // marks of the mature collection.
+    if(compact_pending && mature.sweep_done_p()) {
+      compact_pending = false;
+      MatureCompactor compactor(this);
+      compactor.compact(roots, false);
+    }
   }
 
   void ObjectMemory::collect_mature(Roots &roots) {
     mature.collect(roots);
+    compact_pending = false;
+
+    // Compacting needs the marks on the young objects and contexts, and
+    // every Page swept. If the sweep is still going, wait for the first
+    // young collection after it is done instead of finishing it here.
+    if(mature.compact_threshold > 0) {
+      if(mature.sweep_done_p()) {
+        MatureCompactor compactor(this);
+        compactor.compact(roots, true);
+      } else {
+        compact_pending = true;
+      }
+    }
+
     young.clear_marks();
     clear_context_marks();
   }
@@ -97,7 +125,7 @@ namespace rubinius {
   /* Store an object into the remember set. Called when we've calculated
    * externally that the object in question needs to be remembered */
   void ObjectMemory::remember_object(Object* target) {
-    assert(target->zone == MatureObjectZone);
+    assert(target->mature_object_p());
     /* If it's already remembered, ignore this request */
     if(target->Remember) return;
     target->Remember = 1;
@@ -118,7 +146,7 @@ namespace rubinius {
   // DEPRECATED
   void ObjectMemory::store_object(Object* target, size_t index, Object* val) {
     ((Tuple*)target)->field[index] = val;
-    write_barrier(target, val);
+    write_barrier(target, &((Tuple*)target)->field[index], val);
   }
 
   void ObjectMemory::set_class(Object* target, Object* obj) {
@@ -128,14 +156,23 @@ namespace rubinius {
     }
   }
 
+  Object* ObjectMemory::allocate_mature(size_t fields) {
+    Object* obj = mature.allocate(fields, &collect_mature_now);
+    if(collect_mature_now) {
+      state->interrupts.check = true;
+    }
+
+    obj->clear_fields();
+    return obj;
+  }
+
   Object* ObjectMemory::allocate_object(size_t fields) {
     Object* obj;
 
+    sweep_mature_slice();
+
     if(fields > large_object_threshold) {
-      obj = mature.allocate(fields, &collect_mature_now);
-      if(collect_mature_now) {
-        state->interrupts.check = true;
-      }
+      return allocate_mature(fields);
     } else {
       obj = young.allocate(fields, &collect_young_now);
       if(obj == NULL) {
@@ -152,7 +189,21 @@ namespace rubinius {
   Object* ObjectMemory::new_object(Class* cls, size_t fields) {
     Object* obj;
 
-    obj = allocate_object(fields);
+    if(pretenure && pretenure_score(cls) >= cPretenureScore) {
+      sweep_mature_slice();
+      obj = allocate_mature(fields);
+
+      // The caller is free to fill in the new object without the write
+      // barrier, as if it were young, so make sure the next young
+      // collection looks at it.
+      remember_object(obj);
+    } else {
+      obj = allocate_object(fields);
+      if(pretenure && obj->young_object_p()) {
+        add_pretenure_score(cls, -cAllocationCost);
+      }
+    }
+
     set_class(obj, cls);
 
     obj->obj_type = (object_type)cls->instance_type()->to_native();
@@ -161,6 +212,36 @@ namespace rubinius {
     return obj;
   }
 
+  native_int ObjectMemory::pretenure_score(Class* cls) {
+    Object* score = cls->pretenure_score();
+    if(!score->fixnum_p()) return 0;
+
+    return as<Fixnum>(score)->to_native();
+  }
+
+  void ObjectMemory::add_pretenure_score(Class* cls, native_int delta) {
+    native_int score = pretenure_score(cls) + delta;
+
+    // Don't let a long run of short lived instances bury the score.
+    if(score < -cPretenureScore) score = -cPretenureScore;
+
+    cls->pretenure_score(state, Fixnum::from(score));
+  }
+
+  /* Called by the young collector when +obj+ is promoted for being old
+   * enough. A young Class may have been copied already, in which case
+   * the score has to go to the copy. */
+  void ObjectMemory::note_survivor(Object* obj) {
+    if(!pretenure || !obj->klass()) return;
+
+    Object* klass = obj->klass();
+    if(klass->reference_p() && klass->forwarded_p()) klass = klass->forward();
+
+    if(Class* cls = try_as<Class>(klass)) {
+      add_pretenure_score(cls, cSurvivalCredit);
+    }
+  }
+
   /* An Object field is the size of a pointer on any particular
    * platform. An Object that stores bytes must be aligned to an
    * integral number of fields. For example, if sizeof(Object*) == 4,
@@ -37,19 +37,32 @@ namespace rubinius {
 
     static const int cContextHeapSize = 1024 * 1024;
 
+    /* Pretenuring. Every young allocation of a Class costs it
+     * cAllocationCost and every instance that lives to be promoted
+     * earns it cSurvivalCredit, so the score only climbs while more
+     * than 90% of instances survive. Past cPretenureScore, instances
+     * are allocated straight into the mature generation. */
+    static const native_int cAllocationCost = 9;
+    static const native_int cSurvivalCredit = 10;
+    static const native_int cPretenureScore = 2000;
+
     bool collect_young_now;
     bool collect_mature_now;
+    bool compact_pending;
 
     STATE;
     ObjectArray *remember_set;
+    ObjectArray *card_set;
     BakerGC young;
     MarkSweepGC mature;
     Heap contexts;
     size_t last_object_id;
+    native_int last_class_id;
     TypeInfo* type_info[(int)LastObjectType];
 
     /* Config variables */
     size_t large_object_threshold;
+    bool   pretenure;
 
     ObjectMemory(STATE, size_t young_bytes);
     ~ObjectMemory();
@@ -67,6 +80,10 @@ namespace rubinius {
     void collect_young(Roots &roots);
     void collect_mature(Roots &roots);
     Object* promote_object(Object* obj);
+    Object* allocate_mature(size_t fields);
+    native_int pretenure_score(Class* cls);
+    void    add_pretenure_score(Class* cls, native_int delta);
+    void    note_survivor(Object* obj);
     bool valid_object_p(Object* obj);
     void debug_marksweep(bool val);
     void add_type_info(TypeInfo* ti);
@@ -75,6 +92,14 @@ namespace rubinius {
 
     void clear_context_marks();
 
+    // Do a bounded amount of any mature sweeping left over from the
+    // last collection, unless the sweeper thread is doing it.
+    void sweep_mature_slice() {
+      if(unlikely(mature.sweep_pending) && !mature.background_sweep) {
+        mature.sweep_slice(mature.sweep_slice_pages);
+      }
+    }
+
     // Indicate whether +ctx+ is located on the context stack
     bool context_on_stack_p(MethodContext* ctx) {
       return (Object*)ctx->klass() == Qnil;
@@ -115,6 +140,13 @@ namespace rubinius {
       return true;
     }
 
+    // Return the space of +ctx+, which has been copied into the heap, to
+    // the context storage area, if nothing has been allocated above it.
+    void release_context(MethodContext* ctx) {
+      if((address)((uintptr_t)ctx + ctx->full_size) != contexts.current) return;
+      contexts.put_back(ctx->full_size);
+    }
+
     // Mark that +ctx+ has been referenced and should not be
     // deallocated as normal.
     void reference_context(MethodContext* ctx) {
@@ -136,11 +168,35 @@ namespace rubinius {
     void write_barrier(Object* target, Object* val) {
       if(target->Remember) return;
       if(!REFERENCE_P(val)) return;
-      if(target->zone != MatureObjectZone) return;
+      if(!target->mature_object_p()) return;
       if(val->zone != YoungObjectZone) return;
 
       remember_object(target);
     }
+
+    /* Like write_barrier() above, for a store into +slot+ of +target+. A
+     * large Tuple just has the card holding +slot+ dirtied, and goes on
+     * card_set the first time one of its cards is. */
+    void write_barrier(Object* target, Object** slot, Object* val) {
+      if(target->Remember) return;
+      if(!REFERENCE_P(val)) return;
+      if(!target->mature_object_p()) return;
+      if(val->zone != YoungObjectZone) return;
+
+      if(!target->large_object_p() || target->obj_type != TupleType ||
+          target->RefsAreWeak) {
+        remember_object(target);
+        return;
+      }
+
+      MarkSweepGC::Page* page = MarkSweepGC::Page::of(target);
+      page->cards[page->card_index(slot)] = 1;
+
+      if(!page->dirty) {
+        page->dirty = true;
+        card_set->push_back(target);
+      }
+    }
   };
 
 #define FREE(obj) free(obj)
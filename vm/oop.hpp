@@ -200,8 +200,14 @@ to be a simple test for that bit pattern.
       return zone == YoungObjectZone;
     }
 
+    // Large objects are part of the mature generation too. Their zone
+    // shares the MatureObjectZone bit, so one test covers both.
     bool mature_object_p() const {
-      return zone == MatureObjectZone;
+      return (zone & MatureObjectZone) != 0;
+    }
+
+    bool large_object_p() const {
+      return zone == LargeObjectZone;
     }
 
     bool forwarded_p() const {
@@ -7,10 +7,15 @@
 #define likely(x)       __builtin_expect((long int)(x),1)
 #define unlikely(x)     __builtin_expect((long int)(x),0)
 
+// Start pulling the memory at +addr+ into the cache, because we're
+// about to read it.
+#define prefetch(addr)  __builtin_prefetch((addr))
+
 #else
 
 #define likely(x) x
 #define unlikely(x) x
+#define prefetch(addr)
 
 #endif
 
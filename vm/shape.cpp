@@ -0,0 +1,39 @@
+#include "vm/shape.hpp"
+
+#include "builtin/symbol.hpp"
+
+namespace rubinius {
+  size_t Shape::field_of(Symbol* name) {
+    Fields::iterator it = fields.find(name->index());
+    if(it == fields.end()) return 0;
+
+    return it->second;
+  }
+
+  ShapeTable::ShapeTable() {
+    shapes.push_back(NULL);
+    shapes.push_back(new Shape(1, NULL, NULL));
+  }
+
+  ShapeTable::~ShapeTable() {
+    for(std::vector<Shape*>::iterator i = shapes.begin(); i != shapes.end(); i++) {
+      delete *i;
+    }
+  }
+
+  Shape* ShapeTable::add(Shape* shape, Symbol* name) {
+    Shape::Transitions::iterator it = shape->transitions.find(name->index());
+    if(it != shape->transitions.end()) return it->second;
+
+    if(shape->size() >= cMaxIvars || size() >= cMaxShapes) return NULL;
+
+    Shape* child = new Shape(shapes.size(), shape, name);
+    child->fields = shape->fields;
+    child->fields[name->index()] = shape->size() + 1;
+
+    shapes.push_back(child);
+    shape->transitions[name->index()] = child;
+
+    return child;
+  }
+};
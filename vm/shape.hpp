@@ -0,0 +1,85 @@
+#ifndef RBX_SHAPE_HPP
+#define RBX_SHAPE_HPP
+
+#include "prelude.hpp"
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+/* A Shape is the layout of the instance variables of an object.
+ *
+ * An object that isn't given a slot for an ivar by its TypeInfo keeps
+ * its ivars in a Tuple (see Object::set_ivar). Field 0 of the Tuple is
+ * the id of the object's Shape as a Fixnum, and the rest hold the values
+ * of its ivars. The Shape maps the name of each ivar to its field, in
+ * the order the ivars were first set, so objects that are set up the
+ * same way (usually by the same initialize) share a Shape, and keep an
+ * ivar in the same field. push_ivar and set_ivar remember the Shape id
+ * and field they last saw, making an ivar access a compare and a load.
+ *
+ * Shapes form a tree rooted at the empty Shape. Setting an ivar that
+ * isn't there yet moves the object to the child of its Shape for that
+ * name. Shapes are never freed, so to keep the tree bounded an object
+ * with more than cMaxIvars ivars, or which would need a Shape past
+ * cMaxShapes, keeps its ivars in a LookupTable instead.
+ */
+namespace rubinius {
+
+  class Symbol;
+
+  class Shape {
+  public:
+    typedef std::map<native_int, size_t> Fields;
+    typedef std::map<native_int, Shape*> Transitions;
+
+    native_int id;
+    Shape* parent;
+    Symbol* name;
+    Fields fields;
+    Transitions transitions;
+
+    Shape(native_int id, Shape* parent, Symbol* name) :
+      id(id), parent(parent), name(name) { }
+
+    /* The number of ivars an object of this Shape has. */
+    size_t size() {
+      return fields.size();
+    }
+
+    /* The field of the ivar +name+, or 0 if there is no such ivar. */
+    size_t field_of(Symbol* name);
+  };
+
+  class ShapeTable {
+  public:
+    static const size_t cMaxShapes = 0x4000;
+    static const size_t cMaxIvars = 32;
+    static const size_t cInitialIvars = 4;
+
+    ShapeTable();
+    ~ShapeTable();
+
+    Shape* root() {
+      return shapes[1];
+    }
+
+    /* Id 0 is never used, so a zeroed cache matches no Shape. */
+    Shape* find(native_int id) {
+      return shapes[id];
+    }
+
+    /* The Shape of an object of +shape+ once ivar +name+ is set, or
+     * NULL if it would be too big. */
+    Shape* add(Shape* shape, Symbol* name);
+
+    size_t size() {
+      return shapes.size() - 1;
+    }
+
+  private:
+    std::vector<Shape*> shapes;
+  };
+};
+
+#endif
@@ -402,7 +402,6 @@ extern "C" {
     }
 
     module->method_table()->store(state, method_name, visibility);
-    state->global_cache->clear(module, method_name);
   }
 
 
@@ -0,0 +1,34 @@
+# Sequences of instructions that the interpreter runs as one instruction
+# (a superinstruction), paying for a single dispatch instead of one per
+# instruction. When a VMMethod is threaded, the first instruction of each
+# occurrence of a sequence is replaced by its superinstruction. The rest
+# of the sequence is left in place, so a branch into the middle of it
+# still works.
+#
+# Pick the sequences from counts of the sequences that occur in compiled
+# code, such as the kernel and stdlib, made with:
+#
+#   bin/rbx lib/bin/opcode_ngrams.rb runtime/**/*.rbc lib/**/*.rbc
+#
+# Every instruction in a sequence must be sequential or a send, except
+# the last, which may also branch or return. send_method and send_stack
+# may only come first, since they rewrite their own slot when they
+# inline their target, and only the first slot is dispatched through. Longer sequences are tried
+# before shorter ones that start with the same instruction.
+#
+# See Instructions#generate_superinstructions in codegen/instructions_gen.rb
+# for what is generated from this list.
+
+Superinstructions = [
+  [:push_local, :push_int, :meta_send_op_plus],
+  [:push_local, :meta_push_1, :meta_send_op_plus],
+  [:push_local, :meta_push_1, :meta_send_op_minus],
+  [:push_local, :push_local, :meta_send_op_lt],
+  [:meta_send_op_lt, :goto_if_false],
+  [:push_local, :push_local],
+  [:push_self, :push_local],
+  [:send_method, :pop],
+  [:set_local, :pop],
+  [:pop, :push_local],
+  [:push_nil, :ret],
+]
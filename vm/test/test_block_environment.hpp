@@ -1,7 +1,15 @@
 #include "builtin/block_environment.hpp"
 #include "vm.hpp"
+#include "vmmethod.hpp"
 #include "objectmemory.hpp"
 
+#include "builtin/array.hpp"
+#include "builtin/compiledmethod.hpp"
+#include "builtin/contexts.hpp"
+#include "builtin/iseq.hpp"
+#include "builtin/task.hpp"
+#include "builtin/tuple.hpp"
+
 #include <cxxtest/TestSuite.h>
 
 using namespace rubinius;
@@ -21,4 +29,114 @@ class TestBlockEnvironment : public CxxTest::TestSuite {
   void test_block_environment_fields() {
     TS_ASSERT_EQUALS(5U, BlockEnvironment::fields);
   }
+
+  /* A BlockEnvironment running +ops+, created in a method that is now
+   * active in +task+. */
+  BlockEnvironment* create_block(Task* task, size_t count, opcode* ops) {
+    CompiledMethod* home = CompiledMethod::create(state);
+    home->iseq(state, InstructionSequence::create(state, 1));
+    home->stack_size(state, Fixnum::from(10));
+    home->local_count(state, Fixnum::from(0));
+    home->literals(state, Tuple::create(state, 1));
+    home->formalize(state);
+
+    MethodContext* ctx = MethodContext::create(state, Qnil, home);
+    task->make_active(ctx);
+
+    CompiledMethod* cm = CompiledMethod::create(state);
+    cm->iseq(state, InstructionSequence::create(state, count));
+    for(size_t i = 0; i < count; i++) {
+      cm->iseq()->opcodes()->put(state, i, Fixnum::from(ops[i]));
+    }
+    cm->stack_size(state, Fixnum::from(10));
+    cm->local_count(state, Fixnum::from(2));
+    cm->literals(state, Tuple::create(state, 0));
+
+    return BlockEnvironment::under_context(state, cm, ctx, ctx, 0);
+  }
+
+  void test_call_single_arg_skips_tuple() {
+    opcode ops[] = {
+      InstructionSequence::insn_cast_for_single_block_arg,
+      InstructionSequence::insn_push_nil,
+      InstructionSequence::insn_ret
+    };
+
+    Task* task = Task::create(state);
+    BlockEnvironment* be = create_block(task, 3, ops);
+    MethodContext* home = task->active();
+    int sp = home->calculate_sp();
+
+    task->push(be);
+    task->push(Fixnum::from(3));
+    be->call(state, task, 1);
+
+    TS_ASSERT_EQUALS(home->calculate_sp(), sp);
+    TS_ASSERT_EQUALS(be->vmm->block_args, VMMethod::cBlockArgsSingle);
+    TS_ASSERT_EQUALS(task->active()->ip, 1);
+    TS_ASSERT_EQUALS(task->stack_top(), Fixnum::from(3));
+  }
+
+  void test_call_multi_args_sets_locals() {
+    opcode ops[] = {
+      InstructionSequence::insn_cast_for_multi_block_arg,
+      InstructionSequence::insn_cast_array,
+      InstructionSequence::insn_shift_array,
+      InstructionSequence::insn_set_local_depth, 0, 0,
+      InstructionSequence::insn_pop,
+      InstructionSequence::insn_shift_array,
+      InstructionSequence::insn_set_local_depth, 0, 1,
+      InstructionSequence::insn_pop,
+      InstructionSequence::insn_pop,
+      InstructionSequence::insn_push_nil,
+      InstructionSequence::insn_ret
+    };
+
+    Task* task = Task::create(state);
+    BlockEnvironment* be = create_block(task, 15, ops);
+    MethodContext* home = task->active();
+    int sp = home->calculate_sp();
+
+    task->push(be);
+    task->push(Fixnum::from(1));
+    task->push(Fixnum::from(2));
+    task->push(Fixnum::from(3));
+    be->call(state, task, 3);
+
+    TS_ASSERT_EQUALS(home->calculate_sp(), sp);
+    TS_ASSERT_EQUALS(be->vmm->block_args, VMMethod::cBlockArgsMulti);
+
+    MethodContext* ctx = task->active();
+    TS_ASSERT_EQUALS(ctx->ip, 13);
+    TS_ASSERT_EQUALS(ctx->calculate_sp(), 1);
+    TS_ASSERT_EQUALS(ctx->get_local(0), Fixnum::from(1));
+    TS_ASSERT_EQUALS(ctx->get_local(1), Fixnum::from(2));
+  }
+
+  void test_call_multi_args_with_array_uses_tuple() {
+    opcode ops[] = {
+      InstructionSequence::insn_cast_for_multi_block_arg,
+      InstructionSequence::insn_cast_array,
+      InstructionSequence::insn_shift_array,
+      InstructionSequence::insn_set_local_depth, 0, 0,
+      InstructionSequence::insn_pop,
+      InstructionSequence::insn_pop,
+      InstructionSequence::insn_push_nil,
+      InstructionSequence::insn_ret
+    };
+
+    Task* task = Task::create(state);
+    BlockEnvironment* be = create_block(task, 10, ops);
+
+    Array* ary = Array::create(state, 1);
+    task->push(be);
+    task->push(ary);
+    be->call(state, task, 1);
+
+    TS_ASSERT_EQUALS(task->active()->ip, 0);
+
+    Tuple* tup = as<Tuple>(task->stack_top());
+    TS_ASSERT_EQUALS(tup->num_fields(), 1U);
+    TS_ASSERT_EQUALS(tup->at(state, 0), ary);
+  }
 };
@@ -135,5 +135,69 @@ class TestContexts : public CxxTest::TestSuite {
 
     TS_ASSERT_SAME_DATA(&ctx->js, &dup->js, sizeof(dup->js));
   }
+
+  void test_promote_active() {
+    Task* task = Task::create(state);
+
+    CompiledMethod* cm = CompiledMethod::create(state);
+    cm->iseq(state, InstructionSequence::create(state, 1));
+    cm->iseq()->opcodes()->put(state, 0, Fixnum::from(InstructionSequence::insn_ret));
+    cm->stack_size(state, Fixnum::from(10));
+    cm->local_count(state, Fixnum::from(0));
+    cm->literals(state, Tuple::create(state, 0));
+    cm->formalize(state);
+
+    MethodContext* caller = MethodContext::create(state, Qnil, cm);
+    task->make_active(caller);
+    MethodContext* ctx = MethodContext::create(state, Qtrue, cm);
+    task->make_active(ctx);
+    task->push(Qfalse);
+
+    TS_ASSERT(state->om->context_on_stack_p(ctx));
+    address top = state->om->contexts.current;
+
+    MethodContext* promoted = task->promote_active();
+
+    TS_ASSERT_EQUALS(promoted, task->active());
+    TS_ASSERT(!state->om->context_on_stack_p(promoted));
+    TS_ASSERT(!state->om->contexts.contains_p(promoted));
+    TS_ASSERT_EQUALS(promoted, promoted->home());
+    TS_ASSERT_EQUALS(Qtrue, promoted->self());
+    TS_ASSERT_EQUALS(Qfalse, task->stack_top());
+    TS_ASSERT_EQUALS(0, task->calculate_sp());
+
+    MethodContext* sender = promoted->sender();
+    TS_ASSERT(sender != caller);
+    TS_ASSERT(!state->om->context_on_stack_p(sender));
+    TS_ASSERT_EQUALS(sender, sender->home());
+
+    TS_ASSERT(state->om->contexts.current < top);
+    TS_ASSERT(state->om->contexts.current <= (address)caller);
+
+    // Nothing is left on the stack to move
+    TS_ASSERT_EQUALS(promoted, task->promote_active());
+  }
+
+  void test_promote_remembers_large_copy() {
+    MethodContext* ctx = MethodContext::create(state, 3000);
+    ctx->sender(state, (MethodContext*)Qnil);
+    ctx->home(state, ctx);
+    ctx->self(state, Qnil);
+    ctx->cm(state, (CompiledMethod*)Qnil);
+    ctx->module(state, (Module*)Qnil);
+    ctx->block(state, Qnil);
+    ctx->name(state, Qnil);
+    ctx->vmm = NULL;
+
+    TS_ASSERT(state->om->context_on_stack_p(ctx));
+
+    MethodContext* promoted = ctx->promote(state);
+
+    TS_ASSERT(promoted->large_object_p());
+    TS_ASSERT_EQUALS(promoted->Remember, 1U);
+    TS_ASSERT_EQUALS(promoted->klass(), G(methctx));
+    TS_ASSERT_EQUALS(promoted, promoted->home());
+    TS_ASSERT_EQUALS(promoted->calculate_sp(), ctx->calculate_sp());
+  }
 };
 
@@ -18,7 +18,7 @@ class TestModule : public CxxTest::TestSuite {
   }
 
   void test_module_fields() {
-    TS_ASSERT_EQUALS(4U, Module::fields);
+    TS_ASSERT_EQUALS(5U, Module::fields);
   }
 
   void test_includedmodule_fields() {
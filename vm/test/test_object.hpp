@@ -1,5 +1,6 @@
 #include "vm.hpp"
 #include "objectmemory.hpp"
+#include "shape.hpp"
 #include "builtin/object.hpp"
 #include "builtin/compactlookuptable.hpp"
 
@@ -130,7 +131,7 @@ class TestObject : public CxxTest::TestSuite {
     TS_ASSERT_EQUALS(tup2->get_ivar(state, state->symbol("@name")),
         state->symbol("foo"));
 
-    tup->ivars_ = as<CompactLookupTable>(tup->ivars_)->to_lookuptable(state);
+    tup->ivars_ = as<CompactLookupTable>(tup->get_ivars(state))->to_lookuptable(state);
     Tuple* tup3 = as<Tuple>(tup->dup(state));
 
     TS_ASSERT(tup->ivars_ != tup2->ivars_);
@@ -260,6 +261,43 @@ class TestObject : public CxxTest::TestSuite {
     TS_ASSERT_EQUALS(obj->get_ivar(state, sym), Fixnum::from(5));
   }
 
+  void test_set_ivar_shares_shape() {
+    Object* obj = util_new_object();
+    Object* obj2 = util_new_object();
+    Symbol* t1 = state->symbol("@test1");
+    Symbol* t2 = state->symbol("@test2");
+
+    obj->set_ivar(state, t1, Fixnum::from(1));
+    obj->set_ivar(state, t2, Fixnum::from(2));
+    obj2->set_ivar(state, t1, Fixnum::from(3));
+    obj2->set_ivar(state, t2, Fixnum::from(4));
+
+    Tuple* ivars = as<Tuple>(obj->ivars());
+    Tuple* ivars2 = as<Tuple>(obj2->ivars());
+    TS_ASSERT_EQUALS(ivars->at(state, 0), ivars2->at(state, 0));
+    TS_ASSERT_EQUALS(ivars2->at(state, 2), Fixnum::from(4));
+
+    Object* obj3 = util_new_object();
+    obj3->set_ivar(state, t2, Qtrue);
+    TS_ASSERT_DIFFERS(as<Tuple>(obj3->ivars())->at(state, 0), ivars->at(state, 0));
+    TS_ASSERT_EQUALS(obj3->get_ivar(state, t1), Qnil);
+  }
+
+  void test_set_ivar_past_max_ivars() {
+    Object* obj = util_new_object();
+    char buf[16];
+
+    for(size_t i = 0; i <= ShapeTable::cMaxIvars; i++) {
+      snprintf(buf, sizeof(buf), "@test%d", (int)i);
+      obj->set_ivar(state, state->symbol(buf), Fixnum::from(i));
+    }
+
+    TS_ASSERT(kind_of<LookupTable>(obj->ivars()));
+    TS_ASSERT_EQUALS(obj->get_ivar(state, state->symbol("@test0")), Fixnum::from(0));
+    TS_ASSERT_EQUALS(obj->get_ivar(state, state->symbol(buf)),
+        Fixnum::from(ShapeTable::cMaxIvars));
+  }
+
   void test_set_ivar_on_immediate() {
     size_t size = COMPACTLOOKUPTABLE_SIZE / 2 + 2;
     Object* obj = Fixnum::from(-10);
@@ -4,9 +4,12 @@
 #include "vm/gc_root.hpp"
 #include "vm/object_utils.hpp"
 #include "objectmemory.hpp"
+#include "global_cache.hpp"
 
 #include "builtin/array.hpp"
 
+#include <unistd.h>
+
 #include <cxxtest/TestSuite.h>
 
 using namespace rubinius;
@@ -213,6 +216,44 @@ class TestObjectMemory : public CxxTest::TestSuite {
     TS_ASSERT_EQUALS(((Tuple*)mature->field[0])->field[0], Qtrue);
   }
 
+  void test_collect_young_scans_dirty_cards() {
+    ObjectMemory om(state, 1024);
+    Tuple *young, *mature;
+    const size_t fields = 4000;
+
+    om.large_object_threshold = 10;
+
+    young =  (Tuple*)om.allocate_object(3);
+    mature = (Tuple*)om.allocate_object(fields);
+    young->klass_ = reinterpret_cast<Class*>(Qnil);
+    mature->klass_ = reinterpret_cast<Class*>(Qnil);
+    mature->obj_type = TupleType;
+
+    for(size_t i = 0; i < fields; i++) mature->field[i] = Qnil;
+
+    young->field[0] = Qtrue;
+    om.store_object(mature, 3000, young);
+
+    TS_ASSERT(mature->large_object_p());
+    TS_ASSERT_EQUALS(mature->Remember, 0U);
+    TS_ASSERT_EQUALS(om.remember_set->size(), 0U);
+    TS_ASSERT_EQUALS(om.card_set->size(), 1U);
+
+    MarkSweepGC::Page* page = MarkSweepGC::Page::of(mature);
+    TS_ASSERT(page->cards[page->card_index(&mature->field[3000])]);
+    TS_ASSERT(!page->cards[page->card_index(&mature->field[0])]);
+
+    Roots roots;
+    om.collect_young(roots);
+
+    TS_ASSERT(mature->field[3000] != young);
+    TS_ASSERT_EQUALS(((Tuple*)mature->field[3000])->field[0], Qtrue);
+
+    /* Still young, so the card stays dirty for the next collection. */
+    TS_ASSERT(page->cards[page->card_index(&mature->field[3000])]);
+    TS_ASSERT_EQUALS(om.card_set->size(), 1U);
+  }
+
   void test_collect_young_promotes_objects() {
     ObjectMemory om(state, 1024);
     Object* young;
@@ -234,6 +275,82 @@ class TestObjectMemory : public CxxTest::TestSuite {
     TS_ASSERT(roots.front()->get()->mature_object_p());
   }
 
+  void test_collect_young_adapts_to_survival() {
+    ObjectMemory om(state, 1024);
+    Tuple* young;
+
+    om.young.adaptive = true;
+
+    young = (Tuple*)om.allocate_object(10);
+    young->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    for(size_t i = 0; i < 10; i++) {
+      Object* obj = om.allocate_object(3);
+      obj->klass_ = reinterpret_cast<Class*>(Qnil);
+      young->field[i] = obj;
+    }
+
+    Roots roots;
+    Root r(&roots, young);
+
+    /* Everything survives and fills more than half the semispace. */
+    om.collect_young(roots);
+
+    TS_ASSERT_EQUALS(om.young.lifetime, 5U);
+    TS_ASSERT_EQUALS(om.young.desired_bytes, 2048U);
+    TS_ASSERT_EQUALS(om.young.next->size, 2048U);
+
+    /* Now nothing survives, so it shrinks back down. */
+    r.set(Qnil);
+    om.allocate_object(3)->klass_ = reinterpret_cast<Class*>(Qnil);
+    om.collect_young(roots);
+
+    TS_ASSERT_EQUALS(om.young.allocated_bytes, SIZE_IN_BYTES_FIELDS(3));
+    TS_ASSERT_EQUALS(om.young.copied_bytes, 0U);
+    TS_ASSERT_EQUALS(om.young.desired_bytes, 1024U);
+  }
+
+  void test_new_object_pretenures_surviving_classes() {
+    ObjectMemory& om = *state->om;
+    Class* cls;
+    Object* obj;
+
+    size_t lifetime = om.young.lifetime;
+
+    /* Make room in the young generation after bootstrapping. */
+    om.set_young_lifetime(0);
+    state->collect();
+
+    cls = state->new_class("Pretenured");
+
+    om.pretenure = true;
+
+    obj = om.new_object(cls, 3);
+    TS_ASSERT(obj->young_object_p());
+    TS_ASSERT_EQUALS(om.pretenure_score(cls), -ObjectMemory::cAllocationCost);
+
+    /* What BakerGC::saw_object does when it promotes obj for its age */
+    om.note_survivor(obj);
+    TS_ASSERT_EQUALS(om.pretenure_score(cls),
+        ObjectMemory::cSurvivalCredit - ObjectMemory::cAllocationCost);
+
+    cls->pretenure_score(state, Fixnum::from(ObjectMemory::cPretenureScore));
+
+    obj = om.new_object(cls, 3);
+    TS_ASSERT(obj->mature_object_p());
+    TS_ASSERT_EQUALS(obj->Remember, 1U);
+    TS_ASSERT_EQUALS(obj->klass(), cls);
+
+    /* Once cls has been copied, the score goes to the copy. */
+    Class* copy = state->new_class("PretenuredCopy");
+    cls->set_forward(state, copy);
+    om.note_survivor(obj);
+    TS_ASSERT_EQUALS(om.pretenure_score(copy), ObjectMemory::cSurvivalCredit);
+
+    om.pretenure = false;
+    om.set_young_lifetime(lifetime);
+  }
+
   void test_collect_young_resets_remember_set() {
     ObjectMemory om(state, 1024);
     Tuple *young, *mature;
@@ -340,18 +457,140 @@ class TestObjectMemory : public CxxTest::TestSuite {
     TS_ASSERT(mature->mature_object_p());
     TS_ASSERT_EQUALS(om.mature.allocated_objects, 1U);
 
-    MarkSweepGC::Entry *entry = om.mature.find_entry(mature);
-    TS_ASSERT(entry->unmarked_p());
+    TS_ASSERT(!om.mature.marked_p(mature));
 
     Roots roots;
     om.collect_mature(roots);
 
+    /* debug_marksweep() keeps empty pages around, so the mark bit
+     * can still be inspected. */
     TS_ASSERT_EQUALS(om.mature.allocated_objects, 0U);
-    TS_ASSERT(entry->unmarked_p());
+    TS_ASSERT(!om.mature.marked_p(mature));
+    TS_ASSERT_EQUALS(om.mature.validate_object(mature), cUnknown);
+  }
+
+  void test_collect_mature_reuses_freed_slots() {
+    ObjectMemory om(state, 1024);
+    Object* mature;
+
+    om.large_object_threshold = 10;
 
-    /* debug_marksweep() causes it to not free any Entry's, so
-     * we have to do it now. */
-    delete entry;
+    mature = om.allocate_object(20);
+    mature->klass_ = reinterpret_cast<Class*>(Qnil);
+    TS_ASSERT_EQUALS(om.mature.validate_object(mature), cMatureObject);
+
+    Roots roots;
+    om.collect_mature(roots);
+
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, 0U);
+    TS_ASSERT_EQUALS(om.mature.page_bytes, 0U);
+
+    Object* obj = om.allocate_object(20);
+    Object* obj2 = om.allocate_object(20);
+    obj->klass_ = reinterpret_cast<Class*>(Qnil);
+    obj2->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    Root r(&roots, obj2);
+    om.collect_mature(roots);
+
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, 1U);
+    TS_ASSERT_EQUALS(om.allocate_object(20), obj);
+  }
+
+  void test_collect_mature_frees_large_objects() {
+    ObjectMemory om(state, 1024);
+    Object* obj;
+
+    om.large_object_threshold = 10;
+
+    obj = om.allocate_object(MarkSweepGC::cMaxSlotBytes / sizeof(Object*));
+    obj->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    TS_ASSERT(om.mature.large_pages);
+    TS_ASSERT_EQUALS(MarkSweepGC::Page::of(obj)->first_object(), obj);
+    TS_ASSERT(obj->large_object_p());
+    TS_ASSERT(obj->mature_object_p());
+    TS_ASSERT_EQUALS(om.mature.page_bytes % getpagesize(), 0U);
+
+    Roots roots;
+    om.collect_mature(roots);
+
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, 0U);
+    TS_ASSERT(!om.mature.large_pages);
+    TS_ASSERT_EQUALS(om.mature.page_bytes, 0U);
+  }
+
+  void test_collect_mature_sweeps_lazily() {
+    ObjectMemory om(state, 1024);
+    Object* obj;
+    Object* obj2;
+
+    om.large_object_threshold = 10;
+    om.mature.lazy_sweep = true;
+    om.mature.sweep_slice_pages = 1;
+
+    obj  = om.allocate_object(20);
+    obj2 = om.allocate_object(40);
+    obj->klass_ = reinterpret_cast<Class*>(Qnil);
+    obj2->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    Roots roots;
+    Root r(&roots, obj2);
+
+    om.collect_mature(roots);
+
+    TS_ASSERT(om.mature.sweep_pending);
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, 2U);
+
+    /* Allocating while the sweep is pending doesn't lose new objects. */
+    Object* obj3 = om.allocate_object(20);
+    obj3->klass_ = reinterpret_cast<Class*>(Qnil);
+    TS_ASSERT_EQUALS(om.mature.validate_object(obj3), cMatureObject);
+
+    om.mature.finish_sweep();
+
+    TS_ASSERT(!om.mature.sweep_pending);
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, 2U);
+    TS_ASSERT_EQUALS(om.mature.validate_object(obj2), cMatureObject);
+    TS_ASSERT_EQUALS(om.mature.validate_object(obj3), cMatureObject);
+  }
+
+  void test_collect_mature_sweeps_in_background() {
+    ObjectMemory om(state, 1024);
+    Object* obj;
+    Object* keep;
+    const size_t count = 20000;
+
+    om.large_object_threshold = 10;
+    om.mature.background_sweep = true;
+
+    keep = om.allocate_object(20);
+    keep->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    for(size_t i = 0; i < count; i++) {
+      obj = om.allocate_object(20);
+      obj->klass_ = reinterpret_cast<Class*>(Qnil);
+    }
+
+    Roots roots;
+    Root r(&roots, keep);
+
+    om.collect_mature(roots);
+
+    TS_ASSERT(om.mature.sweeper_running);
+
+    /* The allocator takes what the sweeper has freed, or sweeps itself. */
+    for(size_t i = 0; i < count; i++) {
+      obj = om.allocate_object(20);
+      obj->klass_ = reinterpret_cast<Class*>(Qnil);
+    }
+
+    om.mature.finish_sweep();
+
+    TS_ASSERT(!om.mature.sweep_pending);
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, count + 1);
+    TS_ASSERT_EQUALS(om.mature.validate_object(keep), cMatureObject);
+    TS_ASSERT_EQUALS(om.mature.validate_object(obj), cMatureObject);
   }
 
   void test_collect_mature_marks_young_objects() {
@@ -410,6 +649,175 @@ class TestObjectMemory : public CxxTest::TestSuite {
     TS_ASSERT_EQUALS(mature->field[0], young);
   }
 
+  /* Would overflow the C stack if marking recursed. */
+  void test_collect_mature_marks_deep_chains() {
+    ObjectMemory om(state, 1024);
+    Tuple *head, *obj;
+    const size_t depth = 200000;
+
+    om.large_object_threshold = 0;
+
+    head = obj = (Tuple*)om.allocate_object(1);
+    obj->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    for(size_t i = 1; i < depth; i++) {
+      Tuple* next = (Tuple*)om.allocate_object(1);
+      next->klass_ = reinterpret_cast<Class*>(Qnil);
+      obj->field[0] = next;
+      obj = next;
+    }
+
+    Roots roots;
+    Root r(&roots, head);
+
+    om.collect_mature(roots);
+
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, depth);
+    TS_ASSERT(om.mature.mark_stack.empty());
+  }
+
+  void test_collect_mature_marks_in_parallel() {
+    ObjectMemory om(state, 1024);
+    Tuple *top, *obj;
+    const size_t width = 64;
+    const size_t depth = 500;
+
+    om.large_object_threshold = 0;
+    om.mature.mark_threads = 4;
+
+    top = (Tuple*)om.allocate_object(width);
+    top->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    for(size_t i = 0; i < width; i++) {
+      obj = (Tuple*)om.allocate_object(2);
+      obj->klass_ = reinterpret_cast<Class*>(Qnil);
+      top->field[i] = obj;
+
+      for(size_t j = 1; j < depth; j++) {
+        Tuple* next = (Tuple*)om.allocate_object(2);
+        next->klass_ = reinterpret_cast<Class*>(Qnil);
+        obj->field[0] = next;
+        obj->field[1] = top;
+
+        // Garbage hanging off nothing, to be swept.
+        obj = (Tuple*)om.allocate_object(2);
+        obj->klass_ = reinterpret_cast<Class*>(Qnil);
+        obj = next;
+      }
+    }
+
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, 1 + width * (depth * 2 - 1));
+
+    Roots roots;
+    Root r(&roots, top);
+
+    om.collect_mature(roots);
+
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, 1 + width * depth);
+    TS_ASSERT_EQUALS(om.mature.validate_object(top), cMatureObject);
+    TS_ASSERT_EQUALS(om.mature.validate_object(obj), cMatureObject);
+    TS_ASSERT(om.mature.mark_stack.empty());
+  }
+
+  void test_collect_mature_compacts_sparse_pages() {
+    ObjectMemory om(state, 1024);
+    Tuple *keep, *obj;
+    const size_t count = 10000;
+    const size_t kept = count / 10;
+
+    om.large_object_threshold = 0;
+    om.mature.compact_threshold = 50;
+
+    keep = (Tuple*)om.allocate_object(kept);
+    keep->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    // Keep every tenth object, each pointing at the one kept before it.
+    Object* last = Qnil;
+    for(size_t i = 0; i < count; i++) {
+      obj = (Tuple*)om.allocate_object(2);
+      obj->klass_ = reinterpret_cast<Class*>(Qnil);
+
+      if(i % 10 == 0) {
+        obj->field[1] = last;
+        keep->field[i / 10] = obj;
+        last = obj;
+      }
+    }
+
+    size_t before = om.mature.page_bytes;
+
+    Roots roots;
+    Root r(&roots, keep);
+
+    om.collect_mature(roots);
+
+    TS_ASSERT_EQUALS(om.mature.compactions, 1U);
+    TS_ASSERT(om.mature.compacted_bytes > 0);
+    TS_ASSERT_EQUALS(om.mature.page_bytes, before - om.mature.compacted_bytes);
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, kept + 1);
+
+    for(size_t i = 0; i < kept; i++) {
+      obj = (Tuple*)keep->field[i];
+      TS_ASSERT_EQUALS(om.mature.validate_object(obj), cMatureObject);
+      TS_ASSERT(!obj->forwarded_p());
+      TS_ASSERT_EQUALS(obj->field[1], i == 0 ? Qnil : keep->field[i - 1]);
+    }
+  }
+
+  void test_collect_mature_defers_compaction_until_swept() {
+    ObjectMemory om(state, 1024);
+    Tuple *keep, *obj;
+    const size_t count = 10000;
+    const size_t kept = count / 10;
+
+    om.large_object_threshold = 0;
+    om.mature.compact_threshold = 50;
+    om.mature.lazy_sweep = true;
+
+    keep = (Tuple*)om.allocate_object(kept);
+    keep->klass_ = reinterpret_cast<Class*>(Qnil);
+
+    for(size_t i = 0; i < count; i++) {
+      obj = (Tuple*)om.allocate_object(2);
+      obj->klass_ = reinterpret_cast<Class*>(Qnil);
+      if(i % 10 == 0) keep->field[i / 10] = obj;
+    }
+
+    Roots roots;
+    Root r(&roots, keep);
+
+    om.collect_mature(roots);
+
+    TS_ASSERT_EQUALS(om.mature.compactions, 0U);
+    TS_ASSERT(om.compact_pending);
+
+    // Still not swept, so nothing happens yet.
+    om.collect_young(roots);
+    TS_ASSERT_EQUALS(om.mature.compactions, 0U);
+
+    // A mature method the compaction may move.
+    Object* meth = om.allocate_object(2);
+    meth->klass_ = reinterpret_cast<Class*>(Qnil);
+    Root m(&roots, meth);
+
+    Symbol* name = state->symbol("blah");
+    state->global_cache->retain(state, G(object), name, G(object), (Executable*)meth, false);
+
+    om.mature.finish_sweep();
+    om.collect_young(roots);
+
+    TS_ASSERT_EQUALS(om.mature.compactions, 1U);
+    TS_ASSERT(!state->global_cache->lookup(G(object), name));
+    TS_ASSERT(!om.compact_pending);
+    TS_ASSERT_EQUALS(om.mature.allocated_objects, kept + 2);
+
+    for(size_t i = 0; i < kept; i++) {
+      obj = (Tuple*)keep->field[i];
+      TS_ASSERT_EQUALS(om.mature.validate_object(obj), cMatureObject);
+      TS_ASSERT(!obj->forwarded_p());
+    }
+  }
+
   void test_collect_young_stops_at_already_marked_objects() {
     ObjectMemory om(state, 1024);
     Tuple *obj, *obj2;
@@ -162,6 +162,159 @@ class TestSendSite : public CxxTest::TestSuite {
     TS_ASSERT_EQUALS(true, msg.method_missing);
   }
 
+  static ExecuteStatus fake_executor(STATE, Task* task, Message& msg) {
+    return cExecuteContinue;
+  }
+
+  void test_poly_performer_caches_each_receiver_class() {
+    Message msg(state);
+    Symbol* sym = state->symbol("blah");
+    SendSite* ss = SendSite::create(state, sym);
+    Executable* exe = Executable::allocate(state, G(executable));
+    Class* classes[SendSite::cMaxEntries + 1];
+
+    exe->set_executor(fake_executor);
+
+    for(size_t i = 0; i <= SendSite::cMaxEntries; i++) {
+      classes[i] = state->new_class("PolyTest");
+      state->global_cache->retain(state, classes[i], sym, classes[i], exe, false);
+    }
+
+    msg.name = sym;
+    msg.send_site = ss;
+    msg.method_missing = false;
+
+    for(size_t i = 0; i < SendSite::cMaxEntries; i++) {
+      msg.lookup_from = classes[i];
+      ss->performer(state, NULL, msg);
+      msg.lookup_from = classes[i];
+      ss->performer(state, NULL, msg);
+    }
+
+    TS_ASSERT_EQUALS(performer::poly_performer, ss->performer);
+    TS_ASSERT_EQUALS(SendSite::cMaxEntries, ss->entry_count);
+    TS_ASSERT_EQUALS(SendSite::cMaxEntries, ss->hits);
+    TS_ASSERT_EQUALS(SendSite::cMaxEntries - 1, ss->misses);
+
+    for(size_t i = 0; i < SendSite::cMaxEntries; i++) {
+      TS_ASSERT_EQUALS(classes[i], ss->entries[i].recv_class);
+      TS_ASSERT_EQUALS(exe, ss->entries[i].method);
+      TS_ASSERT_EQUALS(1U, ss->entries[i].hits);
+    }
+
+    msg.lookup_from = classes[SendSite::cMaxEntries];
+    ss->performer(state, NULL, msg);
+
+    TS_ASSERT_EQUALS(performer::mega_performer, ss->performer);
+    TS_ASSERT_EQUALS(SendSite::cMaxEntries, ss->entry_count);
+    TS_ASSERT_EQUALS(exe, msg.method);
+
+    ss->initialize(state);
+    TS_ASSERT_EQUALS(0U, ss->entry_count);
+  }
+
+  void test_invalidated_name_refills_the_site() {
+    Message msg(state);
+    Symbol* sym = state->symbol("blah");
+    SendSite* ss = SendSite::create(state, sym);
+    Executable* exe = Executable::allocate(state, G(executable));
+    Executable* exe2 = Executable::allocate(state, G(executable));
+    Class* cls = state->new_class("SerialTest");
+
+    exe->set_executor(fake_executor);
+    exe2->set_executor(fake_executor);
+    state->global_cache->retain(state, cls, sym, cls, exe, false);
+
+    msg.name = sym;
+    msg.send_site = ss;
+    msg.lookup_from = cls;
+    ss->performer(state, NULL, msg);
+    ss->performer(state, NULL, msg);
+
+    TS_ASSERT_EQUALS(performer::mono_performer, ss->performer);
+    TS_ASSERT_EQUALS(1U, ss->hits);
+
+    state->global_cache->invalidate(sym);
+    TS_ASSERT(!state->global_cache->lookup(cls, sym));
+
+    state->global_cache->retain(state, cls, sym, cls, exe2, false);
+    ss->performer(state, NULL, msg);
+
+    TS_ASSERT_EQUALS(1U, ss->hits);
+    TS_ASSERT_EQUALS(1U, ss->misses);
+    TS_ASSERT_EQUALS(exe2, ss->method());
+    TS_ASSERT_EQUALS(1U, ss->entry_count);
+
+    ss->performer(state, NULL, msg);
+    TS_ASSERT_EQUALS(2U, ss->hits);
+  }
+
+  void test_resolve_missing_caches_method_missing() {
+    Message msg(state);
+    Symbol* sym = state->symbol("blah");
+    Symbol* mm = G(sym_method_missing);
+    Executable* exe = Executable::allocate(state, G(executable));
+    Executable* mm_exe = Executable::allocate(state, G(executable));
+    Executable* mm_exe2 = Executable::allocate(state, G(executable));
+    Class* cls = state->new_class("MissingTest");
+
+    cls->method_table()->store(state, mm, mm_exe);
+
+    msg.name = sym;
+    msg.lookup_from = cls;
+    TS_ASSERT(GlobalCacheResolver::resolve_missing(state, msg));
+    TS_ASSERT(msg.method_missing);
+    TS_ASSERT_EQUALS(mm, msg.name);
+    TS_ASSERT_EQUALS(mm_exe, msg.method);
+
+    struct GlobalCache::cache_entry* entry = state->global_cache->lookup(cls, sym);
+    TS_ASSERT(entry);
+    TS_ASSERT(entry->method_missing);
+    TS_ASSERT_EQUALS(mm_exe, entry->method);
+
+    msg.name = sym;
+    msg.priv = false;
+    msg.method_missing = false;
+    TS_ASSERT(!GlobalCacheResolver::resolve(state, msg));
+
+    // A new method_missing does away with the entry.
+    cls->method_table()->store(state, mm, mm_exe2);
+    TS_ASSERT(!state->global_cache->lookup(cls, sym));
+
+    msg.name = sym;
+    msg.priv = false;
+    msg.method_missing = false;
+    TS_ASSERT(GlobalCacheResolver::resolve_missing(state, msg));
+    TS_ASSERT_EQUALS(mm_exe2, msg.method);
+
+    // So does defining the method.
+    cls->method_table()->store(state, sym, exe);
+    TS_ASSERT(!state->global_cache->lookup(cls, sym));
+
+    msg.name = sym;
+    msg.priv = false;
+    msg.method_missing = false;
+    TS_ASSERT(GlobalCacheResolver::resolve_missing(state, msg));
+    TS_ASSERT(!msg.method_missing);
+    TS_ASSERT_EQUALS(exe, msg.method);
+  }
+
+  void test_entries_prim() {
+    Symbol* sym = state->symbol("blah");
+    SendSite* ss = SendSite::create(state, sym);
+
+    ss->entry_count = 1;
+    ss->entries[0].recv_class = G(object);
+    ss->entries[0].hits = 3;
+
+    Array* ary = ss->entries_prim(state);
+    TS_ASSERT_EQUALS(1U, ary->size());
+
+    Tuple* tup = as<Tuple>(ary->get(state, 0));
+    TS_ASSERT_EQUALS(G(object), tup->at(state, 0));
+    TS_ASSERT_EQUALS(Fixnum::from(3), tup->at(state, 1));
+  }
+
   void test_misses_prim() {
     Symbol* sym = state->symbol("blah");
     SendSite* ss = SendSite::create(state, sym);
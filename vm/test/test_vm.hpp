@@ -1,11 +1,17 @@
 #include "vm.hpp"
 #include "objectmemory.hpp"
 #include "gc_debug.hpp"
+#include "config.hpp"
+#include "global_cache.hpp"
+
+#include "builtin/system.hpp"
+#include "builtin/tuple.hpp"
 
 #include <cxxtest/TestSuite.h>
 
 #include <map>
 #include <vector>
+#include <sstream>
 
 using namespace rubinius;
 
@@ -26,6 +32,26 @@ class TestVM : public CxxTest::TestSuite {
     TS_ASSERT_EQUALS(Qnil, state->probe.get());
   }
 
+  void test_apply_user_config() {
+    std::istringstream stream;
+
+    stream.str("rbx.gc.lazy_sweep = true\nrbx.gc.sweep_slice = 3\n"
+               "rbx.gc.mark_threads = 4\nrbx.gc.background_sweep = 1\n"
+               "rbx.gc.young_adaptive = 1\nrbx.gc.young_max = 8388608\n"
+               "rbx.gc.lifetime = 3\nrbx.gc.pretenure = 1\n");
+    state->user_config->import_stream(stream);
+    state->apply_user_config();
+
+    TS_ASSERT(state->om->mature.lazy_sweep);
+    TS_ASSERT_EQUALS(state->om->mature.sweep_slice_pages, 3U);
+    TS_ASSERT_EQUALS(state->om->mature.mark_threads, 4U);
+    TS_ASSERT(state->om->mature.background_sweep);
+    TS_ASSERT(state->om->young.adaptive);
+    TS_ASSERT_EQUALS(state->om->young.max_bytes, 8388608U);
+    TS_ASSERT_EQUALS(state->om->young.lifetime, 3U);
+    TS_ASSERT(state->om->pretenure);
+  }
+
   void test_symbol_given_cstr() {
     Symbol* sym1 = state->symbol("blah");
     Symbol* sym2 = state->symbol("blah");
@@ -103,6 +129,85 @@ class TestVM : public CxxTest::TestSuite {
     //  state->om->young.total_objects << ")" << std::endl;
   }
 
+  void test_global_cache_survives_young_collection() {
+    Symbol* name = state->symbol("blah");
+    Class* cls = state->new_class("CacheTest");
+    Executable* meth = Executable::allocate(state, G(executable));
+
+    TypedRoot<Class*> cls_root(state, cls);
+    TypedRoot<Executable*> meth_root(state, meth);
+
+    state->global_cache->retain(state, cls, name, cls, meth, false);
+    native_int id = cls->id(state);
+
+    state->om->collect_young(state->globals.roots);
+
+    cls = cls_root.get();
+    TS_ASSERT_EQUALS(id, cls->id(state));
+
+    struct GlobalCache::cache_entry* entry = state->global_cache->lookup(cls, name);
+    TS_ASSERT(entry);
+    TS_ASSERT_EQUALS(cls, entry->klass);
+    TS_ASSERT_EQUALS(meth_root.get(), entry->method);
+
+    cls->method_table()->store(state, name, meth_root.get());
+    TS_ASSERT(!state->global_cache->lookup(cls, name));
+  }
+
+  void test_global_cache_forward_skips_empty_slots() {
+    Object* slot = NULL;
+    TS_ASSERT(GlobalCache::forward(&slot));
+    TS_ASSERT_EQUALS(slot, (Object*)NULL);
+  }
+
+  void test_global_cache_sets_evict_oldest_entry() {
+    GlobalCache* cache = state->global_cache;
+    Symbol* name = state->symbol("blah");
+    Executable* meth = Executable::allocate(state, G(executable));
+
+    // One set, so every class competes for the same ways.
+    cache->resize(CPU_CACHE_WAYS);
+    TS_ASSERT_EQUALS((size_t)CPU_CACHE_WAYS, cache->size);
+
+    Class* classes[CPU_CACHE_WAYS + 1];
+    for(size_t i = 0; i <= CPU_CACHE_WAYS; i++) {
+      classes[i] = state->new_class("CacheTest");
+    }
+
+    size_t hits = cache->hits;
+    size_t misses = cache->misses;
+    size_t evictions = cache->evictions;
+
+    for(size_t i = 0; i < CPU_CACHE_WAYS; i++) {
+      cache->retain(state, classes[i], name, classes[i], meth, false);
+    }
+    TS_ASSERT_EQUALS(evictions, cache->evictions);
+
+    // Touch the first, so the second is the oldest.
+    TS_ASSERT(cache->lookup(classes[0], name));
+    TS_ASSERT(cache->lookup(classes[0], name));
+
+    cache->retain(state, classes[CPU_CACHE_WAYS], name,
+                  classes[CPU_CACHE_WAYS], meth, false);
+    TS_ASSERT_EQUALS(evictions + 1, cache->evictions);
+
+    TS_ASSERT(cache->lookup(classes[0], name));
+    TS_ASSERT(!cache->lookup(classes[1], name));
+    TS_ASSERT(cache->lookup(classes[CPU_CACHE_WAYS], name));
+
+    TS_ASSERT_EQUALS(hits + 4, cache->hits);
+    TS_ASSERT_EQUALS(misses + 1, cache->misses);
+
+    Tuple* stats = System::vm_method_cache_stats(state);
+    TS_ASSERT_EQUALS(Fixnum::from(CPU_CACHE_WAYS), stats->at(state, 0));
+    TS_ASSERT_EQUALS(Fixnum::from(CPU_CACHE_WAYS), stats->at(state, 1));
+    TS_ASSERT_EQUALS(Fixnum::from(cache->hits), stats->at(state, 2));
+    TS_ASSERT_EQUALS(Fixnum::from(cache->misses), stats->at(state, 3));
+    TS_ASSERT_EQUALS(Fixnum::from(cache->evictions), stats->at(state, 4));
+
+    cache->resize(CPU_CACHE_SIZE);
+  }
+
   void test_current_thread() {
     Object* current_thread = state->globals.current_thread.get();
 
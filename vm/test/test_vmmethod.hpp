@@ -1,6 +1,15 @@
 
 #include "vmmethod.hpp"
 
+#include "message.hpp"
+#include "primitives.hpp"
+
+#include "builtin/compiledmethod.hpp"
+#include "builtin/contexts.hpp"
+#include "builtin/float.hpp"
+#include "builtin/iseq.hpp"
+#include "builtin/task.hpp"
+
 #include <cxxtest/TestSuite.h>
 
 using namespace rubinius;
@@ -58,4 +67,156 @@ public:
     TS_ASSERT_EQUALS(vmm.opcodes[2], static_cast<unsigned int>(InstructionSequence::insn_push_nil));
   }
 
+  void test_resume_checks_interrupts_on_backward_branch() {
+    CompiledMethod* cm = CompiledMethod::create(state);
+    cm->iseq(state, InstructionSequence::create(state, 3));
+    cm->iseq()->opcodes()->put(state, 0, Fixnum::from(InstructionSequence::insn_push_nil));
+    cm->iseq()->opcodes()->put(state, 1, Fixnum::from(InstructionSequence::insn_goto));
+    cm->iseq()->opcodes()->put(state, 2, Fixnum::from(0));
+    cm->stack_size(state, Fixnum::from(10));
+    cm->local_count(state, Fixnum::from(0));
+    cm->literals(state, Tuple::create(state, 0));
+    cm->formalize(state);
+
+    Task* task = Task::create(state);
+    MethodContext* ctx = MethodContext::create(state, Qnil, cm);
+    task->make_active(ctx);
+
+    state->interrupts.check = true;
+    ctx->vmm->resume(task, ctx);
+    state->interrupts.check = false;
+
+    TS_ASSERT(ctx->vmm->threaded);
+    TS_ASSERT_EQUALS(ctx->ip, 0);
+    TS_ASSERT_EQUALS(ctx->vmm->backedge_count, 1U);
+    TS_ASSERT_EQUALS(ctx->vmm->threaded[1],
+        VMMethod::instructions[InstructionSequence::insn_goto]);
+    TS_ASSERT_EQUALS((uintptr_t)ctx->vmm->threaded[2], 0U);
+  }
+
+  void test_make_threaded_uses_superinstructions() {
+    CompiledMethod* cm = CompiledMethod::create(state);
+    cm->iseq(state, InstructionSequence::create(state, 6));
+    cm->iseq()->opcodes()->put(state, 0, Fixnum::from(InstructionSequence::insn_push_true));
+    cm->iseq()->opcodes()->put(state, 1, Fixnum::from(InstructionSequence::insn_set_local));
+    cm->iseq()->opcodes()->put(state, 2, Fixnum::from(0));
+    cm->iseq()->opcodes()->put(state, 3, Fixnum::from(InstructionSequence::insn_pop));
+    cm->iseq()->opcodes()->put(state, 4, Fixnum::from(InstructionSequence::insn_goto));
+    cm->iseq()->opcodes()->put(state, 5, Fixnum::from(0));
+    cm->stack_size(state, Fixnum::from(10));
+    cm->local_count(state, Fixnum::from(1));
+    cm->literals(state, Tuple::create(state, 0));
+    cm->formalize(state);
+
+    Task* task = Task::create(state);
+    MethodContext* ctx = MethodContext::create(state, Qnil, cm);
+    task->make_active(ctx);
+    int sp = ctx->calculate_sp();
+
+    state->interrupts.check = true;
+    ctx->vmm->resume(task, ctx);
+    state->interrupts.check = false;
+
+    size_t super = ctx->vmm->find_superinstruction(1);
+    TS_ASSERT(super);
+    TS_ASSERT_EQUALS(ctx->vmm->threaded[1], VMMethod::instructions[super]);
+    TS_ASSERT_EQUALS(ctx->vmm->threaded[3],
+        VMMethod::instructions[InstructionSequence::insn_pop]);
+
+    TS_ASSERT_EQUALS(ctx->ip, 0);
+    TS_ASSERT_EQUALS(ctx->get_local(0), Qtrue);
+    TS_ASSERT_EQUALS(ctx->calculate_sp(), sp);
+  }
+
+  void test_execute_counts_calls() {
+    CompiledMethod* cm = CompiledMethod::create(state);
+    cm->iseq(state, InstructionSequence::create(state, 2));
+    cm->iseq()->opcodes()->put(state, 0, Fixnum::from(InstructionSequence::insn_push_nil));
+    cm->iseq()->opcodes()->put(state, 1, Fixnum::from(InstructionSequence::insn_ret));
+    cm->stack_size(state, Fixnum::from(1));
+    cm->local_count(state, Fixnum::from(0));
+    cm->total_args(state, Fixnum::from(0));
+    cm->required_args(state, Fixnum::from(0));
+    cm->literals(state, Tuple::create(state, 0));
+    cm->formalize(state);
+
+    Task* task = state->new_task();
+
+    Message msg(state);
+    msg.set_args(0);
+    msg.recv = Qnil;
+    msg.module = G(object);
+    msg.name = state->symbol("blah");
+    msg.method = cm;
+    msg.set_caller(task->active());
+
+    TS_ASSERT_EQUALS(cm->backend_method_->call_count, 0U);
+    cm->execute(state, task, msg);
+    TS_ASSERT_EQUALS(cm->backend_method_->call_count, 1U);
+    TS_ASSERT_EQUALS(task->active()->vmm, cm->backend_method_);
+  }
+
+  void test_count_call_leaves_primitives_alone() {
+    CompiledMethod* cm = CompiledMethod::create(state);
+    cm->iseq(state, InstructionSequence::create(state, 2));
+    cm->iseq()->opcodes()->put(state, 0, Fixnum::from(InstructionSequence::insn_push_nil));
+    cm->iseq()->opcodes()->put(state, 1, Fixnum::from(InstructionSequence::insn_ret));
+    cm->stack_size(state, Fixnum::from(1));
+    cm->local_count(state, Fixnum::from(0));
+    cm->total_args(state, Fixnum::from(0));
+    cm->required_args(state, Fixnum::from(0));
+    cm->literals(state, Tuple::create(state, 0));
+    cm->primitive(state, state->symbol("float_neg"));
+    cm->formalize(state);
+
+    executor prim = cm->execute;
+    TS_ASSERT_EQUALS(prim,
+        Primitives::resolve_primitive(state, state->symbol("float_neg")));
+
+    size_t threshold = state->config.jit_threshold;
+    state->config.jit_threshold = 2;
+
+    Task* task = state->new_task();
+
+    // nil isn't a Float, so the primitive fails and the body runs.
+    for(int i = 0; i < 3; i++) {
+      Message msg(state);
+      msg.set_args(0);
+      msg.recv = Qnil;
+      msg.module = G(object);
+      msg.name = state->symbol("blah");
+      msg.method = cm;
+      msg.set_caller(task->active());
+
+      cm->execute(state, task, msg);
+    }
+
+    state->config.jit_threshold = threshold;
+
+    TS_ASSERT_EQUALS(cm->backend_method_->call_count, 3U);
+    TS_ASSERT(!cm->backend_method_->jit_requested);
+    TS_ASSERT_EQUALS(cm->execute, prim);
+  }
+
+  void test_profile_floats() {
+    CompiledMethod* cm = CompiledMethod::create(state);
+    InstructionSequence* iseq = InstructionSequence::create(state, 1);
+    iseq->opcodes()->put(state, 0, Fixnum::from(0));
+    cm->iseq(state, iseq);
+
+    VMMethod vmm(state, cm);
+    Object* one = Fixnum::from(1);
+    Object* half = Float::create(state, 0.5);
+
+    vmm.profile_floats(3, one, half);
+    TS_ASSERT(vmm.float_sites.empty());
+
+    vmm.profile_floats(3, half, half);
+    TS_ASSERT_EQUALS(vmm.float_sites.count(3), 1U);
+
+    vmm.jit_requested = true;
+    vmm.profile_floats(5, half, half);
+    TS_ASSERT_EQUALS(vmm.float_sites.count(5), 0U);
+  }
+
 };
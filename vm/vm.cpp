@@ -2,6 +2,7 @@
 #include "objectmemory.hpp"
 #include "event.hpp"
 #include "global_cache.hpp"
+#include "shape.hpp"
 #include "llvm.hpp"
 
 #include "vm/object_utils.hpp"
@@ -20,6 +21,7 @@
 
 #include <iostream>
 #include <signal.h>
+#include <cstdlib>
 
 // Reset macros since we're inside state
 #undef G
@@ -30,6 +32,8 @@
 namespace rubinius {
   VM::VM(size_t bytes) : current_mark(NULL), reuse_llvm(true) {
     config.compile_up_front = false;
+    config.inline_threshold = 64;
+    config.jit_threshold = 2000;
 
     VM::register_state(this);
 
@@ -38,6 +42,10 @@ namespace rubinius {
     om = new ObjectMemory(this, bytes);
     probe.set(Qnil, &globals.roots);
 
+    // Method tables flush it as soon as they are written to.
+    global_cache = new GlobalCache;
+    shapes = new ShapeTable;
+
     MethodContext::initialize_cache(this);
     TypeInfo::init(this);
 
@@ -52,10 +60,9 @@ namespace rubinius {
 
     signal_events->start(new event::Child::Event(this));
 
-    global_cache = new GlobalCache;
-
 #ifdef ENABLE_LLVM
     VMLLVMMethod::init("vm/instructions.bc");
+    jit = new JITCompiler;
 #endif
     boot_threads();
 
@@ -66,11 +73,16 @@ namespace rubinius {
   }
 
   VM::~VM() {
+#ifdef ENABLE_LLVM
+    // Stop the compiler before anything it uses goes away.
+    delete jit;
+#endif
     delete om;
 
     delete signal_events;
 
     delete global_cache;
+    delete shapes;
 #ifdef ENABLE_LLVM
     if(!reuse_llvm) llvm_cleanup();
 #endif
@@ -184,6 +196,87 @@ namespace rubinius {
     return globals.current_thread.get();
   }
 
+  static bool config_number(ConfigParser* cfg, const char* name, long* val) {
+    ConfigParser::Entry* ent = cfg->find(name);
+    if(!ent) return false;
+
+    if(ent->is_number()) {
+      *val = atol(ent->value.c_str());
+    } else {
+      *val = ent->value == "true" ? 1 : 0;
+    }
+
+    return true;
+  }
+
+  void VM::apply_user_config() {
+    long val;
+
+    if(config_number(user_config, "rbx.gc.lazy_sweep", &val)) {
+      om->mature.lazy_sweep = val != 0;
+    }
+
+    if(config_number(user_config, "rbx.gc.background_sweep", &val)) {
+      om->mature.background_sweep = val != 0;
+    }
+
+    if(config_number(user_config, "rbx.gc.sweep_slice", &val) && val > 0) {
+      om->mature.sweep_slice_pages = val;
+    }
+
+    if(config_number(user_config, "rbx.gc.young_adaptive", &val)) {
+      om->young.adaptive = val != 0;
+    }
+
+    if(config_number(user_config, "rbx.gc.young_bytes", &val) && val > 0) {
+      om->young.desired_bytes = val;
+    }
+
+    if(config_number(user_config, "rbx.gc.young_min", &val) && val > 0) {
+      om->young.min_bytes = val;
+    }
+
+    if(config_number(user_config, "rbx.gc.young_max", &val) && val > 0) {
+      om->young.max_bytes = val;
+    }
+
+    if(config_number(user_config, "rbx.gc.young_survival", &val) && val > 0) {
+      om->young.target_survival = val;
+    }
+
+    if(config_number(user_config, "rbx.gc.lifetime", &val) && val > 0 && val < 8) {
+      om->set_young_lifetime(val);
+    }
+
+    if(config_number(user_config, "rbx.gc.pretenure", &val)) {
+      om->pretenure = val != 0;
+    }
+
+    if(config_number(user_config, "rbx.gc.large_object", &val) && val > 0) {
+      om->large_object_threshold = val;
+    }
+
+    if(config_number(user_config, "rbx.gc.mark_threads", &val) && val > 0) {
+      om->mature.mark_threads = val;
+    }
+
+    if(config_number(user_config, "rbx.gc.compact", &val) && val >= 0 && val <= 100) {
+      om->mature.compact_threshold = val;
+    }
+
+    if(config_number(user_config, "rbx.vm.inline_threshold", &val) && val >= 0) {
+      config.inline_threshold = val;
+    }
+
+    if(config_number(user_config, "rbx.jit.threshold", &val) && val >= 0) {
+      config.jit_threshold = val;
+    }
+
+    if(config_number(user_config, "rbx.cache.size", &val) && val > 0) {
+      global_cache->resize(val);
+    }
+  }
+
   void VM::run_gc_soon() {
     om->collect_young_now = true;
     om->collect_mature_now = true;
@@ -193,21 +286,24 @@ namespace rubinius {
   void VM::collect() {
     om->collect_young(globals.roots);
     om->collect_mature(globals.roots);
+    global_cache->clear();
   }
 
   void VM::collect_maybe() {
     if(om->collect_young_now) {
       om->collect_young_now = false;
       om->collect_young(globals.roots);
-      global_cache->clear();
     }
 
     if(om->collect_mature_now) {
       om->collect_mature_now = false;
+      // Entries may refer to objects the mature collection freed.
       om->collect_mature(globals.roots);
       global_cache->clear();
     }
 
+    om->sweep_mature_slice();
+
     /* Stack Management procedures. Make sure that we don't
      * miss object stored into the stack of a context */
     if(G(current_task)->active()->zone == MatureObjectZone) {
@@ -20,6 +20,8 @@ namespace rubinius {
   }
 
   class GlobalCache;
+  class ShapeTable;
+  class JITCompiler;
   class TaskProbe;
   class Primitives;
   class ObjectMemory;
@@ -32,6 +34,14 @@ namespace rubinius {
 
   struct Configuration {
     bool compile_up_front;
+
+    // How many times a send must hit its monomorphic cache before the
+    // target is considered for inlining. 0 turns inlining off.
+    size_t inline_threshold;
+
+    // How many calls and backward branches an interpreted method may run
+    // before it is JIT compiled. 0 turns the JIT off.
+    size_t jit_threshold;
   };
 
   struct Interrupts {
@@ -62,6 +72,10 @@ namespace rubinius {
     event::Loop* events;
     event::Loop* signal_events;
     GlobalCache* global_cache;
+    ShapeTable* shapes;
+#ifdef ENABLE_LLVM
+    JITCompiler* jit;
+#endif
     TypedRoot<TaskProbe*> probe;
     Primitives* primitives;
     Configuration config;
@@ -182,6 +196,9 @@ namespace rubinius {
 
     // Run the garbage collectors as soon as you can
     void run_gc_soon();
+
+    // Pick up any settings from user_config (rbx.gc.* etc)
+    void apply_user_config();
   };
 };
 
@@ -8,6 +8,7 @@
 #include "builtin/array.hpp"
 #include "builtin/compiledmethod.hpp"
 #include "builtin/fixnum.hpp"
+#include "builtin/float.hpp"
 #include "builtin/iseq.hpp"
 #include "builtin/symbol.hpp"
 #include "builtin/task.hpp"
@@ -16,7 +17,10 @@
 #include "builtin/class.hpp"
 #include "builtin/sendsite.hpp"
 
+#include "global_cache.hpp"
+#include "llvm.hpp"
 #include "profiler.hpp"
+#include "shape.hpp"
 
 /*
  * An internalization of a CompiledMethod which holds the instructions for the
@@ -24,11 +28,16 @@
  */
 namespace rubinius {
 
+  instlocation* VMMethod::instructions = NULL;
+
   /*
    * Turns a CompiledMethod's InstructionSequence into a C array of opcodes.
    */
   VMMethod::VMMethod(STATE, CompiledMethod* meth) :
-      original(state, meth), type(NULL) {
+      threaded(NULL), original(state, meth), type(NULL), literal_count(0), inlines(NULL),
+      constant_caches(NULL), ivar_caches(NULL), call_count(0), backedge_count(0),
+      jit_requested(false), jitted(NULL), block_args(cBlockArgsUnknown),
+      block_args_end(0) {
 
     meth->set_executor(VMMethod::execute);
 
@@ -42,7 +51,8 @@ namespace rubinius {
     if(literals->nil_p()) {
       sendsites = NULL;
     } else {
-      sendsites = new TypedRoot<SendSite*>[literals->num_fields()];
+      literal_count = literals->num_fields();
+      sendsites = new TypedRoot<SendSite*>[literal_count];
     }
 
     Tuple* ops = meth->iseq()->opcodes();
@@ -96,6 +106,10 @@ namespace rubinius {
 
   VMMethod::~VMMethod() {
     delete[] opcodes;
+    delete[] threaded;
+    delete[] inlines;
+    delete[] constant_caches;
+    delete[] ivar_caches;
   }
 
   // Argument handler implementations
@@ -254,6 +268,7 @@ namespace rubinius {
         if(it != ti->slots.end()) {
           opcodes[i] = InstructionSequence::insn_push_my_field;
           opcodes[i + 1] = it->second;
+          if(threaded) thread_instruction(i);
         }
       } else if(op == InstructionSequence::insn_set_ivar) {
         native_int idx = opcodes[i + 1];
@@ -263,6 +278,7 @@ namespace rubinius {
         if(it != ti->slots.end()) {
           opcodes[i] = InstructionSequence::insn_store_my_field;
           opcodes[i + 1] = it->second;
+          if(threaded) thread_instruction(i);
         }
       }
 
@@ -270,13 +286,58 @@ namespace rubinius {
     }
   }
 
+  /*
+   * Counts a call to +cm+, returning the VMMethod to run it with.
+   *
+   * Every method starts out interpreted. Once the calls to it and the
+   * backward branches taken in it add up to config.jit_threshold, it is
+   * queued for the JITCompiler, and the method goes on being interpreted
+   * until the compiled version is ready. The call after that makes it
+   * the method's backend. Contexts already running the interpreted
+   * version carry on with it.
+   *
+   * Methods with a primitive are never queued; their executor is the
+   * primitive, and only falls back here when the primitive fails.
+   */
+  VMMethod* VMMethod::count_call(STATE, CompiledMethod* cm) {
+    VMMethod* vmm = cm->backend_method_;
+    vmm->call_count++;
+
+#ifdef ENABLE_LLVM
+    size_t threshold = state->config.jit_threshold;
+
+    if(unlikely(threshold && !vmm->jit_requested &&
+                cm->primitive()->nil_p() &&
+                vmm->call_count + vmm->backedge_count >= threshold)) {
+      vmm->jit_requested = true;
+      state->jit->add(state, cm, vmm);
+    }
+
+    if(unlikely(vmm->jitted != NULL)) {
+      VMLLVMMethod* llvm = static_cast<VMLLVMMethod*>(vmm->jitted);
+      vmm->jitted = NULL;
+
+      // Compiling failed, leave the method interpreted.
+      if(!llvm->c_func) {
+        delete llvm;
+        return vmm;
+      }
+
+      cm->backend_method_ = llvm;
+      return llvm;
+    }
+#endif
+
+    return vmm;
+  }
+
   template <typename ArgumentHandler>
   ExecuteStatus VMMethod::execute_specialized(STATE, Task* task, Message& msg) {
     CompiledMethod* cm = as<CompiledMethod>(msg.method);
 
-    MethodContext* ctx = MethodContext::create(state, msg.recv, cm);
+    VMMethod* vmm = count_call(state, cm);
 
-    VMMethod* vmm = cm->backend_method_;
+    MethodContext* ctx = MethodContext::create(state, msg.recv, cm);
 
     // Copy in things we all need.
     ctx->module(state, msg.module);
@@ -369,6 +430,20 @@ namespace rubinius {
     meth->set_executor(execute_specialized<GenericArguments>);
   }
 
+  /* Whether +exec+ is one of the executors that run a method's opcodes
+   * in the interpreter, i.e. execute or one setup_argument_handler
+   * picks. */
+  bool VMMethod::interpreted_p(executor exec) {
+    return exec == execute ||
+      exec == execute_specialized<NoArguments> ||
+      exec == execute_specialized<SplatOnlyArgument> ||
+      exec == execute_specialized<OneArgument> ||
+      exec == execute_specialized<TwoArguments> ||
+      exec == execute_specialized<ThreeArguments> ||
+      exec == execute_specialized<FixedArguments> ||
+      exec == execute_specialized<GenericArguments>;
+  }
+
   /* This is the execute implementation used by normal Ruby code,
    * as opposed to Primitives or FFI functions.
    * It prepares a Ruby method for execution.
@@ -378,9 +453,9 @@ namespace rubinius {
   ExecuteStatus VMMethod::execute(STATE, Task* task, Message& msg) {
     CompiledMethod* cm = as<CompiledMethod>(msg.method);
 
-    MethodContext* ctx = MethodContext::create(state, msg.recv, cm);
+    VMMethod* vmm = count_call(state, cm);
 
-    VMMethod* vmm = cm->backend_method_;
+    MethodContext* ctx = MethodContext::create(state, msg.recv, cm);
 
     // Copy in things we all need.
     ctx->module(state, msg.module);
@@ -435,6 +510,329 @@ namespace rubinius {
     return cExecuteRestart;
   }
 
+  /* Remember that literal +index+ named +value+ when looked up from
+   * +under+, until constants next change. */
+  void VMMethod::cache_constant(STATE, native_int index, Object* under, Object* value) {
+    if(index < 0 || (size_t)index >= literal_count) return;
+
+    if(!constant_caches) constant_caches = new ConstantCache[literal_count]();
+
+    ConstantCache& cache = constant_caches[index];
+    cache.serial = state->global_cache->constant_serial;
+    cache.under.set(under, &state->globals.roots);
+    cache.value.set(value, &state->globals.roots);
+  }
+
+  /*
+   * Builds the threaded form of opcodes, which resume() runs. Each
+   * instruction is replaced by the address of its code, and its operands
+   * follow it as they are, so an instruction is dispatched with one load
+   * and an indirect jump. Anything that changes opcodes afterwards must
+   * call thread_instruction() for the instruction it changed.
+   *
+   * An instruction that starts one of the sequences in
+   * vm/superinstructions.rb is then replaced by its superinstruction,
+   * which runs the whole sequence. The rest of the sequence stays as it
+   * is, for branches into the middle of it.
+   */
+  void VMMethod::make_threaded() {
+    threaded = new instlocation[total];
+
+    for(size_t ip = 0; ip < total;) {
+      size_t width = thread_instruction(ip);
+
+      if(size_t super = find_superinstruction(ip)) {
+        threaded[ip] = instructions[super];
+      }
+
+      ip += width;
+    }
+  }
+
+  /* Copy the instruction at +ip+ into the threaded form, returning its
+   * width. */
+  size_t VMMethod::thread_instruction(size_t ip) {
+    opcode op = opcodes[ip];
+    size_t width = InstructionSequence::instruction_width(op);
+
+    threaded[ip] = instructions[op];
+    for(size_t i = 1; i < width && ip + i < total; i++) {
+      threaded[ip + i] = (instlocation)(uintptr_t)opcodes[ip + i];
+    }
+
+    return width;
+  }
+
+  /* Remember where the ivar +name+ of +self+ is, if it is kept by Shape,
+   * for the push_ivar or set_ivar of literal +index+. */
+  void VMMethod::cache_ivar(STATE, native_int index, Object* self, Symbol* name) {
+    if(index < 0 || (size_t)index >= literal_count) return;
+    if(!self->reference_p()) return;
+
+    Tuple* tup = try_as<Tuple>(self->ivars());
+    if(!tup) return;
+
+    Shape* shape = state->shapes->find(as<Fixnum>(tup->field[0])->to_native());
+    size_t field = shape->field_of(name);
+    if(!field) return;
+
+    if(!ivar_caches) ivar_caches = new IvarCache[literal_count]();
+
+    IvarCache& cache = ivar_caches[index];
+    cache.shape = tup->field[0];
+    cache.field = field;
+  }
+
+  /* Remember that the arithmetic meta send at +ip+ was given two Floats,
+   * for VMLLVMMethod::generate. Only done until the method goes to the
+   * JIT, as nothing looks at it after that. */
+  void VMMethod::profile_floats(size_t ip, Object* left, Object* right) {
+    if(jit_requested) return;
+
+    if(kind_of<Float>(left) && kind_of<Float>(right)) {
+      float_sites.insert(ip);
+    }
+  }
+
+  /*
+   * Works out how this block takes the values it is yielded, from the
+   * instructions the compiler starts it with. These are one of:
+   *
+   *   pop                              (no arguments)
+   *   cast_for_single_block_arg        (|a|)
+   *   cast_for_multi_block_arg         (|a, b|)
+   *   cast_array
+   *   shift_array, set_local a, pop    (once for each argument, or
+   *                                     set_local_depth 0 for locals
+   *                                     of the block)
+   *   pop
+   *
+   * Other forms, such as a splat, get cBlockArgsTuple.
+   */
+  void VMMethod::find_block_args() {
+    block_args = cBlockArgsTuple;
+    if(total == 0) return;
+
+    switch(opcodes[0]) {
+    case InstructionSequence::insn_pop:
+      block_args = cBlockArgsNone;
+      block_args_end = 1;
+      return;
+    case InstructionSequence::insn_cast_for_single_block_arg:
+      block_args = cBlockArgsSingle;
+      block_args_end = 1;
+      return;
+    case InstructionSequence::insn_cast_for_multi_block_arg:
+      break;
+    default:
+      return;
+    }
+
+    Iterator iter(this);
+    iter.inc();
+    if(iter.end() || iter.op() != InstructionSequence::insn_cast_array) return;
+    iter.inc();
+
+    std::vector<BlockArgLocal> locals;
+    while(!iter.end() && iter.op() == InstructionSequence::insn_shift_array) {
+      iter.inc();
+      if(iter.end()) return;
+
+      BlockArgLocal local;
+      switch(iter.op()) {
+      case InstructionSequence::insn_set_local:
+        local.home = true;
+        local.index = iter.operand1();
+        break;
+      case InstructionSequence::insn_set_local_depth:
+        if(iter.operand1() != 0) return;
+        local.home = false;
+        local.index = iter.operand2();
+        break;
+      default:
+        return;
+      }
+      locals.push_back(local);
+
+      iter.inc();
+      if(iter.end() || iter.op() != InstructionSequence::insn_pop) return;
+      iter.inc();
+    }
+
+    if(iter.end() || iter.op() != InstructionSequence::insn_pop) return;
+    iter.inc();
+
+    block_args = cBlockArgsMulti;
+    block_arg_locals = locals;
+    block_args_end = iter.position;
+  }
+
+  /*
+   * Whether this method can be run in place of a send with +args+
+   * arguments, and if so, fills in the instruction to run in +inl+.
+   *
+   * That is a method that either produces a value from self, a literal
+   * or an instance variable and returns it (a reader), or stores its one
+   * argument in an instance variable and returns it (a writer).
+   */
+  bool VMMethod::inline_body(size_t args, InlineSend& inl) {
+    if(total < 2) return false;
+    if(splat_position >= 0 || total_args != required_args) return false;
+    if(total_args != (native_int)args) return false;
+
+    size_t width = InstructionSequence::instruction_width(opcodes[0]);
+    size_t start = 0;
+
+    if(args == 1) {
+      // push_local 0 puts the argument where the store expects it.
+      if(opcodes[0] != InstructionSequence::insn_push_local || opcodes[1] != 0) {
+        return false;
+      }
+
+      start = width;
+      if(start >= total) return false;
+      width = InstructionSequence::instruction_width(opcodes[start]);
+    }
+
+    if(start + width >= total) return false;
+    if(opcodes[start + width] != InstructionSequence::insn_ret) return false;
+
+    opcode op = opcodes[start];
+
+    switch(op) {
+    case InstructionSequence::insn_set_ivar:
+    case InstructionSequence::insn_store_my_field:
+      if(args != 1) return false;
+      break;
+    case InstructionSequence::insn_push_self:
+    case InstructionSequence::insn_push_nil:
+    case InstructionSequence::insn_push_true:
+    case InstructionSequence::insn_push_false:
+    case InstructionSequence::insn_push_int:
+    case InstructionSequence::insn_push_literal:
+    case InstructionSequence::insn_push_ivar:
+    case InstructionSequence::insn_push_my_field:
+    case InstructionSequence::insn_meta_push_neg_1:
+    case InstructionSequence::insn_meta_push_0:
+    case InstructionSequence::insn_meta_push_1:
+    case InstructionSequence::insn_meta_push_2:
+      if(args != 0) return false;
+      break;
+    default:
+      return false;
+    }
+
+    inl.op = op;
+    inl.arg = width > 1 ? opcodes[start + 1] : 0;
+    return true;
+  }
+
+  /*
+   * Splice the target of the send at +ip+, whose SendSite is literal
+   * +index+, into this method if it is small enough, by replacing the
+   * send with +insn+. The target must be the one the SendSite has settled
+   * on, and the SendSite must still be current for its name.
+   *
+   * The send is left alone if it isn't at +ip+ (e.g. the instruction is
+   * being run outside of this method's opcodes), or if it has already
+   * fallen back to a real send too often.
+   */
+  bool VMMethod::inline_send(STATE, native_int index, size_t args,
+                             native_int ip, opcode insn) {
+    if(state->config.inline_threshold == 0) return false;
+
+    if(ip < 0 || (size_t)ip + 1 >= total) return false;
+    if(opcodes[ip + 1] != (opcode)index) return false;
+    if(index < 0 || (size_t)index >= literal_count) return false;
+
+    if(!inlines) inlines = new InlineSend[literal_count]();
+
+    InlineSend& inl = inlines[index];
+    if(inl.deopts >= cMaxDeopts) return false;
+
+    SendSite* ss = sendsites[index].get();
+    if(ss->performer != performer::mono_performer) return false;
+
+    uint32_t serial = state->global_cache->serial(ss->name());
+    if(ss->name_serial != serial) return false;
+
+    CompiledMethod* cm = try_as<CompiledMethod>(ss->method());
+    if(!cm || !cm->backend_method_) return false;
+
+    // A primitive's body is only what runs when the primitive fails.
+    if(!cm->primitive()->nil_p() || !interpreted_p(cm->execute)) return false;
+
+    InlineSend body = inl;
+    if(!cm->backend_method_->inline_body(args, body)) return false;
+
+    body.serial = serial;
+    inl = body;
+    opcodes[ip] = insn;
+    if(threaded) thread_instruction(ip);
+
+    return true;
+  }
+
+  /*
+   * Run the inlined target of the send at literal +index+ for +recv+,
+   * with +arg+ the argument of a writer. Returns NULL, having dropped the
+   * inlined target, if +recv+ is not of the class it was inlined for or
+   * methods of its name have changed since. The caller then does a real
+   * send instead.
+   */
+  Object* VMMethod::run_inline(STATE, native_int index, Object* recv, Object* arg) {
+    if(!inlines) return NULL;
+
+    InlineSend& inl = inlines[index];
+    if(inl.op == InstructionSequence::insn_noop) return NULL;
+
+    SendSite* ss = sendsites[index].get();
+
+    if(unlikely(recv->lookup_begin(state) != ss->recv_class() ||
+                inl.serial != state->global_cache->serial(ss->name()))) {
+      inl.op = InstructionSequence::insn_noop;
+      inl.deopts++;
+      return NULL;
+    }
+
+    CompiledMethod* cm = as<CompiledMethod>(ss->method());
+
+    switch(inl.op) {
+    case InstructionSequence::insn_push_self:
+      return recv;
+    case InstructionSequence::insn_push_nil:
+      return Qnil;
+    case InstructionSequence::insn_push_true:
+      return Qtrue;
+    case InstructionSequence::insn_push_false:
+      return Qfalse;
+    case InstructionSequence::insn_push_int:
+      return Fixnum::from(inl.arg);
+    case InstructionSequence::insn_meta_push_neg_1:
+      return Fixnum::from(-1);
+    case InstructionSequence::insn_meta_push_0:
+      return Fixnum::from(0);
+    case InstructionSequence::insn_meta_push_1:
+      return Fixnum::from(1);
+    case InstructionSequence::insn_meta_push_2:
+      return Fixnum::from(2);
+    case InstructionSequence::insn_push_literal:
+      return cm->literals()->at(state, inl.arg);
+    case InstructionSequence::insn_push_ivar:
+      return recv->get_ivar(state, as<Symbol>(cm->literals()->at(state, inl.arg)));
+    case InstructionSequence::insn_push_my_field:
+      return recv->get_field(state, inl.arg);
+    case InstructionSequence::insn_set_ivar:
+      recv->set_ivar(state, as<Symbol>(cm->literals()->at(state, inl.arg)), arg);
+      return arg;
+    case InstructionSequence::insn_store_my_field:
+      recv->set_field(state, inl.arg, arg);
+      return arg;
+    }
+
+    return NULL;
+  }
+
   /* This is a noop for this class. */
   void VMMethod::compile(STATE) { }
 
@@ -511,6 +909,8 @@ namespace rubinius {
     switch(op) {
     case InstructionSequence::insn_send_method:
     case InstructionSequence::insn_send_stack:
+    case InstructionSequence::insn_inline_send_method:
+    case InstructionSequence::insn_inline_send_stack:
     case InstructionSequence::insn_send_stack_with_block:
     case InstructionSequence::insn_send_stack_with_splat:
     case InstructionSequence::insn_meta_send_op_plus:
@@ -530,6 +930,8 @@ namespace rubinius {
     switch(op) {
     case InstructionSequence::insn_send_method:
     case InstructionSequence::insn_send_stack:
+    case InstructionSequence::insn_inline_send_method:
+    case InstructionSequence::insn_inline_send_stack:
     case InstructionSequence::insn_send_stack_with_block:
     case InstructionSequence::insn_send_stack_with_splat:
     case InstructionSequence::insn_meta_send_op_plus:
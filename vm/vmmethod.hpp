@@ -1,6 +1,7 @@
 #ifndef RBX_VMMETHOD_HPP
 #define RBX_VMMETHOD_HPP
 
+#include <set>
 #include <vector>
 
 #include "executor.hpp"
@@ -8,6 +9,10 @@
 #include "primitives.hpp"
 #include "type_info.hpp"
 
+#include "vm/object_utils.hpp"
+
+#include "builtin/tuple.hpp"
+
 namespace rubinius {
   typedef void* instlocation;
   typedef uint32_t opcode;
@@ -20,14 +25,77 @@ namespace rubinius {
 
   class VMMethod {
   public:
+    /* A send whose target is simple enough to be run in place, without
+     * a MethodContext. The target's body is a single instruction, which
+     * is kept here along with its operand. An +op+ of noop means nothing
+     * is inlined for the send. */
+    struct InlineSend {
+      opcode op;
+      opcode arg;
+      uint32_t serial;
+      uint32_t deopts;
+    };
+
+    /* What the push_const or find_const of a literal found, while the
+     * constant serial is +serial+ and the lookup starts at +under+ (the
+     * StaticScope for push_const, the module for find_const). */
+    struct ConstantCache {
+      uint32_t serial;
+      TypedRoot<Object*> under;
+      TypedRoot<Object*> value;
+    };
+
+    /* Where the push_ivar or set_ivar of a literal last found its ivar:
+     * +field+ of the ivars Tuple of an object whose Shape has the id
+     * +shape+ (see shape.hpp). +shape+ is NULL until then. */
+    struct IvarCache {
+      Object* shape;
+      size_t field;
+    };
+
+    /* How a block's code takes the values it is yielded, worked out by
+     * find_block_args. BlockEnvironment::call uses it to hand the values
+     * over without putting them in a Tuple, when it can. */
+    enum BlockArgs {
+      cBlockArgsUnknown,
+      // It starts with a pop, so doesn't use them.
+      cBlockArgsNone,
+      // It starts with cast_for_single_block_arg.
+      cBlockArgsSingle,
+      // It starts with cast_for_multi_block_arg and cast_array, and then
+      // stores each one in a local (see block_arg_locals).
+      cBlockArgsMulti,
+      // Anything else, they have to be yielded as a Tuple.
+      cBlockArgsTuple
+    };
+
+    /* A local that cBlockArgsMulti stores an argument in: of the home
+     * context for set_local, or of the block's for set_local_depth 0. */
+    struct BlockArgLocal {
+      bool home;
+      size_t index;
+    };
+
+    // How often an inlined send may fall back to a real send before
+    // it stays a real send.
+    static const uint32_t cMaxDeopts = 4;
+
+    // The address of the code for each instruction in resume(), once
+    // it has been run.
     static instlocation* instructions;
 
     opcode* opcodes;
+    // opcodes with each instruction replaced by the address of its code.
+    instlocation* threaded;
     std::size_t total;
     TypedRoot<CompiledMethod*> original;
     TypeInfo* type;
     std::vector<VMMethod*> blocks;
     TypedRoot<SendSite*> *sendsites;
+    std::size_t literal_count;
+    InlineSend* inlines;
+    ConstantCache* constant_caches;
+    IvarCache* ivar_caches;
 
     native_int total_args;
     native_int required_args;
@@ -36,6 +104,28 @@ namespace rubinius {
     native_int stack_size;
     native_int number_of_locals;
 
+    // Calls to this method, and backward branches taken in it, while it
+    // is interpreted. See VMMethod::count_call.
+    size_t call_count;
+    size_t backedge_count;
+
+    // Set once the method has been handed to the JIT, so that it is only
+    // tried once.
+    bool jit_requested;
+
+    // The compiled version of this method, set by the JITCompiler once it
+    // is done and installed by the next call. See JITCompiler.
+    VMMethod* volatile jitted;
+
+    BlockArgs block_args;
+    std::vector<BlockArgLocal> block_arg_locals;
+    // Where the code after the instructions handling the arguments starts.
+    size_t block_args_end;
+
+    // Where the arithmetic meta sends were given two Floats while the
+    // method was interpreted, so the JIT knows to give them a Float path.
+    std::set<size_t> float_sites;
+
     VMMethod(STATE, CompiledMethod* meth);
     virtual ~VMMethod();
 
@@ -49,6 +139,44 @@ namespace rubinius {
     virtual void resume(Task* task, MethodContext* ctx);
 
     void setup_argument_handler(CompiledMethod* meth);
+    static bool interpreted_p(executor exec);
+    static VMMethod* count_call(STATE, CompiledMethod* cm);
+
+    void make_threaded();
+    size_t thread_instruction(size_t ip);
+    size_t find_superinstruction(size_t ip);
+
+    void cache_constant(STATE, native_int index, Object* under, Object* value);
+
+    /* The constant that literal +index+ named when last looked up from
+     * +under+, or NULL if constants have changed since. */
+    Object* cached_constant(native_int index, Object* under, uint32_t serial) {
+      if(!constant_caches) return NULL;
+
+      ConstantCache& cache = constant_caches[index];
+      if(cache.serial != serial || cache.under.get() != under) return NULL;
+
+      return cache.value.get();
+    }
+
+    void cache_ivar(STATE, native_int index, Object* self, Symbol* name);
+    void profile_floats(size_t ip, Object* left, Object* right);
+    void find_block_args();
+
+    /* The Tuple holding the ivars of +self+, if it has the Shape that
+     * literal +index+ was last found with, or NULL. */
+    Tuple* cached_ivars(native_int index, Object* self) {
+      if(!ivar_caches || !self->reference_p()) return NULL;
+
+      Tuple* tup = try_as<Tuple>(self->ivars());
+      if(!tup || tup->field[0] != ivar_caches[index].shape) return NULL;
+
+      return tup;
+    }
+
+    bool inline_body(size_t args, InlineSend& inl);
+    bool inline_send(STATE, native_int index, size_t args, native_int ip, opcode insn);
+    Object* run_inline(STATE, native_int index, Object* recv, Object* arg);
 
     std::vector<Opcode*> create_opcodes();
 
@@ -113,14 +241,16 @@ namespace rubinius {
     int arg2;
     bool start_block;
     std::size_t block;
+    std::size_t ip;
 
     Opcode(opcode op, int o1 = -1, int o2 = -1) :
-      op(op), args(0), arg1(o1), arg2(o2), start_block(false), block(0) {
+      op(op), args(0), arg1(o1), arg2(o2), start_block(false), block(0), ip(0) {
         if(o1 >= 0) args++;
         if(o2 >= 0) args++;
       }
 
-    Opcode(VMMethod::Iterator& iter) : start_block(false), block(0) {
+    Opcode(VMMethod::Iterator& iter) :
+      start_block(false), block(0), ip(iter.position) {
       op = iter.op();
       args = iter.args();
 